@@ -15,6 +15,10 @@ bool GameConfig::saveToFile(const std::string& filename)
     file << "targetFPS=" << targetFPS << "\n";
     file << "fullscreen=" << (fullscreen ? 1 : 0) << "\n";
     file << "lightingQuality=" << static_cast<int>(lightingQuality) << "\n";
+    file << "renderBackend=" << static_cast<int>(renderBackend) << "\n";
+    file << "dynamicResolution=" << (dynamicResolution ? 1 : 0) << "\n";
+    file << "wallSpanTracing=" << (wallSpanTracing ? 1 : 0) << "\n";
+    file << "bakedLighting=" << (bakedLighting ? 1 : 0) << "\n";
     file << "masterVolume=" << masterVolume << "\n";
     file << "musicVolume=" << musicVolume << "\n";
     file << "sfxVolume=" << sfxVolume << "\n";
@@ -64,6 +68,18 @@ bool GameConfig::loadFromFile(const std::string& filename)
             if (quality >= 0 && quality <= 2)
                 lightingQuality = static_cast<LightingQuality>(quality);
         }
+        else if (key == "renderBackend")
+        {
+            int backend = std::stoi(value);
+            if (backend >= 0 && backend <= 1)
+                renderBackend = static_cast<RenderBackend>(backend);
+        }
+        else if (key == "dynamicResolution")
+            dynamicResolution = (std::stoi(value) != 0);
+        else if (key == "wallSpanTracing")
+            wallSpanTracing = (std::stoi(value) != 0);
+        else if (key == "bakedLighting")
+            bakedLighting = (std::stoi(value) != 0);
         else if (key == "mouseSensitivity")
             mouseSensitivity = std::stof(value);
         else if (key == "masterVolume")
@@ -6,11 +6,17 @@
 
 enum class LightingQuality
 {
-    LOW = 0,    // 2 samples + interpolation
-    MEDIUM = 1, // 3 samples
+    LOW = 0,    // 2 samples, every 8th column lit + interpolation
+    MEDIUM = 1, // 3 samples, every 4th column lit + interpolation
     HIGH = 2    // 5 samples (adaptive)
 };
 
+enum class RenderBackend
+{
+    VERTEX_ARRAY = 0, // quads per column, drawn by the GPU
+    FRAMEBUFFER = 1   // CPU pixel buffer + one texture upload
+};
+
 struct GameConfig
 {
     // video
@@ -21,6 +27,10 @@ struct GameConfig
     
     // graphics
     LightingQuality lightingQuality = LightingQuality::HIGH;
+    RenderBackend renderBackend = RenderBackend::VERTEX_ARRAY;
+    bool dynamicResolution = false; // lower the raycast column count to hold targetFPS
+    bool wallSpanTracing = false;   // trace wall-face boundaries only, fill columns in between
+    bool bakedLighting = true;      // static room lights from a lightmap baked at map load
     
     // audio
     float masterVolume = 100.0f;
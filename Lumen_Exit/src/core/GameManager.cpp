@@ -7,6 +7,8 @@
 #include "../rendering/LightSystem.h"
 #include "../rendering/PostProcessing.h"
 #include <iostream>
+#include <random>
+#include <algorithm>
 
 GameManager::GameManager(const GameConfig& config)
     : m_config(config)
@@ -39,18 +41,60 @@ void GameManager::createNewGame()
     
     m_raycaster = new Raycaster(m_config.screenWidth, m_config.screenHeight);
     m_raycaster->setLightingQuality(m_config.lightingQuality);
+    m_raycaster->setRenderBackend(m_config.renderBackend);
+    m_raycaster->setTargetFPS(m_config.targetFPS);
+    m_raycaster->setDynamicResolution(m_config.dynamicResolution);
+    m_raycaster->setWallSpanTracing(m_config.wallSpanTracing);
     
     m_minimap = new Minimap(m_config.screenWidth, m_config.screenHeight);
     m_hud = new HUD(m_config.screenWidth, m_config.screenHeight);
     
     m_lightSystem = new LightSystem();
+    m_lightSystem->setBakedLighting(m_config.bakedLighting);
     m_lightSystem->addRoomLights(*m_map);
+    addBrokenLamps();
     
     m_postProcessing = new PostProcessing(m_config.screenWidth, m_config.screenHeight);
     
     std::cout << "Game created successfully!" << std::endl;
 }
 
+void GameManager::addBrokenLamps()
+{
+    const int lampCount = 4;
+    
+    // corridor runs long enough to hang a lamp in, picked by the map seed so a maze keeps its lamps
+    std::vector<const Region*> corridors;
+    for (const Region& region : m_map->getRegions())
+    {
+        if (region.room < 0 && std::max(region.width, region.height) >= 3)
+            corridors.push_back(&region);
+    }
+    
+    std::mt19937 rng(m_map->getSeed());
+    std::shuffle(corridors.begin(), corridors.end(), rng);
+    std::uniform_real_distribution<float> flickerSpeed(6.0f, 14.0f);
+    
+    for (int i = 0; i < lampCount && i < static_cast<int>(corridors.size()); ++i)
+    {
+        const Region& corridor = *corridors[i];
+        Light lamp(corridor.x + corridor.width / 2.0f, corridor.y + corridor.height / 2.0f,
+                   4.0f, 0.6f, sf::Color(255, 190, 130), false);
+        
+        int handle = m_lightSystem->spawnLight(lamp);
+        m_lightSystem->setLightFlicker(handle, 0.8f, flickerSpeed(rng));
+    }
+}
+
+bool GameManager::setTile(int x, int y, int value)
+{
+    if (!m_map || !m_map->setTile(x, y, value))
+        return false;
+    
+    m_lightSystem->invalidateTile(x, y);
+    return true;
+}
+
 void GameManager::cleanup()
 {
     delete m_map;
@@ -75,6 +119,18 @@ void GameManager::updateSettings(const GameConfig& config)
     if (m_raycaster != nullptr)
     {
         m_raycaster->setLightingQuality(config.lightingQuality);
+        m_raycaster->setRenderBackend(config.renderBackend);
+        m_raycaster->setTargetFPS(config.targetFPS);
+        m_raycaster->setDynamicResolution(config.dynamicResolution);
+        m_raycaster->setWallSpanTracing(config.wallSpanTracing);
         std::cout << "Lighting quality updated" << std::endl;
     }
+    
+    if (m_lightSystem != nullptr && m_lightSystem->isBakedLightingEnabled() != config.bakedLighting)
+    {
+        m_lightSystem->setBakedLighting(config.bakedLighting);
+        
+        if (m_raycaster != nullptr)
+            m_raycaster->invalidateHistory();
+    }
 }
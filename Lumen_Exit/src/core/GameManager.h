@@ -33,7 +33,13 @@ public:
     
     bool isInitialized() const { return m_map != nullptr; }
     
+    // doors, collapsing corridors - changes the tile and tells the light system
+    bool setTile(int x, int y, int value);
+    
 private:
+    // a few failing lamps in the corridors - dynamic lights, so their flicker costs no rebakes
+    void addBrokenLamps();
+    
     const GameConfig& m_config;
     
     Map* m_map;
@@ -367,6 +367,11 @@ int main()
 			std::cout << "FPS limit set to: " << config.targetFPS << std::endl;
 		}
 		
+		if (needsFPSUpdate && gameManager.isInitialized() && gameManager.getRaycaster() != nullptr)
+		{
+			gameManager.getRaycaster()->setTargetFPS(config.targetFPS);
+		}
+		
 		// hot-reload lighting quality
 		if (config.lightingQuality != lastLightingQuality)
 		{
@@ -438,8 +443,11 @@ int main()
 				bool inSafeRoom = gameManager.getPlayer()->isInRoom(*gameManager.getMap());
 				gameManager.getLightSystem()->updateFlashlight(deltaTime, gameManager.getLightSystem()->isFlashlightEnabled(), inSafeRoom);
 				
-				// update visible lights for frustum culling
-				gameManager.getLightSystem()->updateVisibleLights(*gameManager.getPlayer());
+				// cull lights through the map's region graph (first - flicker skips culled lights)
+				gameManager.getLightSystem()->updateVisibleLights(*gameManager.getPlayer(), *gameManager.getMap());
+				
+				// flicker, runtime light changes, finished lightmap bakes
+				gameManager.getLightSystem()->update(deltaTime, *gameManager.getMap());
 				
 				// win condition
 				if (gameManager.getPlayer()->hasReachedExit())
@@ -503,6 +511,12 @@ int main()
 			}
 		}
 
+		// feed the resolution governor with this frame's work time (display() is where the limiter sleeps)
+		if (gameState == GameState::PLAYING && gameManager.isInitialized())
+		{
+			gameManager.getRaycaster()->updateResolutionScale(clock.getElapsedTime().asSeconds());
+		}
+
 		window.display();
 	}
 	
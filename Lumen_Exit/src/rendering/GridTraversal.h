@@ -0,0 +1,155 @@
+#pragma once
+#include "../world/Map.h"
+#include <cmath>
+#include <algorithm>
+
+// Amanatides-Woo cell traversal over the map grid - one stepping core for
+// the raycaster's walls and the light system's visibility tests
+namespace GridTraversal
+{
+    // the last stretch before a LOS target is not tested, so points on wall faces stay visible
+    constexpr float TARGET_BIAS = 1e-3f;
+    
+    // DDA state of one ray. distances are along the direction vector (tiles if it is unit length)
+    struct Walker
+    {
+        int mapX;
+        int mapY;
+        int stepX;
+        int stepY;
+        float deltaDistX;
+        float deltaDistY;
+        float sideDistX;  // distance to the next vertical grid line
+        float sideDistY;  // distance to the next horizontal grid line
+        int side;         // last step crossed 0 = a vertical line, 1 = a horizontal line
+        
+        Walker(float posX, float posY, float dirX, float dirY)
+            : mapX(static_cast<int>(posX))
+            , mapY(static_cast<int>(posY))
+            , stepX(dirX < 0 ? -1 : 1)
+            , stepY(dirY < 0 ? -1 : 1)
+            , side(0)
+        {
+            // avoid div by zero with a big number
+            deltaDistX = (dirX == 0) ? 1e30f : std::abs(1.0f / dirX);
+            deltaDistY = (dirY == 0) ? 1e30f : std::abs(1.0f / dirY);
+            
+            sideDistX = (dirX < 0 ? (posX - mapX) : (mapX + 1.0f - posX)) * deltaDistX;
+            sideDistY = (dirY < 0 ? (posY - mapY) : (mapY + 1.0f - posY)) * deltaDistY;
+        }
+        
+        // distance at which the next cell is entered
+        float nextBoundary() const { return std::min(sideDistX, sideDistY); }
+        
+        // move into the next cell (ties go along y), returns the distance it was entered at
+        float step()
+        {
+            float entered;
+            
+            if (sideDistX < sideDistY)
+            {
+                entered = sideDistX;
+                sideDistX += deltaDistX;
+                mapX += stepX;
+                side = 0;
+            }
+            else
+            {
+                entered = sideDistY;
+                sideDistY += deltaDistY;
+                mapY += stepY;
+                side = 1;
+            }
+            
+            return entered;
+        }
+        
+        // jump across the empty box around the current cell that the distance field guarantees
+        // (see Map::getWallDistance), landing on the last cell inside it, and rebuild the state
+        // from the ray origin so the rest of the walk is unchanged
+        void skipEmptySpace(int freeRadius, float posX, float posY, float dirX, float dirY)
+        {
+            float boxX = dirX < 0 ? static_cast<float>(mapX - freeRadius) : static_cast<float>(mapX + freeRadius + 1);
+            float boxY = dirY < 0 ? static_cast<float>(mapY - freeRadius) : static_cast<float>(mapY + freeRadius + 1);
+            
+            float exitT = std::min(std::abs(boxX - posX) * deltaDistX, std::abs(boxY - posY) * deltaDistY) - 1e-3f;
+            
+            mapX = static_cast<int>(std::floor(posX + dirX * exitT));
+            mapY = static_cast<int>(std::floor(posY + dirY * exitT));
+            
+            sideDistX = (dirX < 0 ? (posX - mapX) : (mapX + 1.0f - posX)) * deltaDistX;
+            sideDistY = (dirY < 0 ? (posY - mapY) : (mapY + 1.0f - posY)) * deltaDistY;
+        }
+    };
+    
+    // true when no solid cell lies between the two points (the origin's own cell isn't tested).
+    // a segment through a grid corner is blocked when both cells beside the corner are solid
+    inline bool lineOfSight(const Map& map, float x1, float y1, float x2, float y2)
+    {
+        float dx = x2 - x1;
+        float dy = y2 - y1;
+        float length = std::sqrt(dx * dx + dy * dy);
+        
+        if (length <= TARGET_BIAS)
+            return true;
+        
+        float dirX = dx / length;
+        float dirY = dy / length;
+        float maxDistance = length - TARGET_BIAS;
+        
+        Walker walker(x1, y1, dirX, dirY);
+        
+        while (walker.nextBoundary() < maxDistance)
+        {
+            if (std::abs(walker.sideDistX - walker.sideDistY) < 1e-5f)
+            {
+                // exactly through a corner - diagonal step, sealed by two touching walls
+                if (map.isSolidFast(walker.mapX + walker.stepX, walker.mapY) &&
+                    map.isSolidFast(walker.mapX, walker.mapY + walker.stepY))
+                {
+                    return false;
+                }
+                
+                walker.sideDistX += walker.deltaDistX;
+                walker.sideDistY += walker.deltaDistY;
+                walker.mapX += walker.stepX;
+                walker.mapY += walker.stepY;
+            }
+            else
+            {
+                walker.step();
+            }
+            
+            if (map.isSolidFast(walker.mapX, walker.mapY))
+                return false;
+            
+            int freeRadius = map.getWallDistance(walker.mapX, walker.mapY) - 1;
+            
+            if (freeRadius >= 2)
+                walker.skipEmptySpace(freeRadius, x1, y1, dirX, dirY);
+        }
+        
+        return true;
+    }
+    
+    // one origin, many targets (light bake, batch lighting). visible[i] is 0 or 1.
+    // targets inside the origin's empty box are visible without walking at all
+    inline void lineOfSightBatch(const Map& map, float originX, float originY,
+                                 const float* targetX, const float* targetY, int count, unsigned char* visible)
+    {
+        int originCellX = static_cast<int>(originX);
+        int originCellY = static_cast<int>(originY);
+        int freeRadius = map.isSolidFast(originCellX, originCellY) ? -1 : map.getWallDistance(originCellX, originCellY) - 1;
+        
+        for (int i = 0; i < count; ++i)
+        {
+            int cellX = static_cast<int>(targetX[i]);
+            int cellY = static_cast<int>(targetY[i]);
+            
+            if (std::abs(cellX - originCellX) <= freeRadius && std::abs(cellY - originCellY) <= freeRadius)
+                visible[i] = 1;
+            else
+                visible[i] = lineOfSight(map, originX, originY, targetX[i], targetY[i]) ? 1 : 0;
+        }
+    }
+}
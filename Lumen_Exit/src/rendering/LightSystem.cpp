@@ -2,20 +2,50 @@
 #include "../world/Player.h"
 #include "../world/Map.h"
 #include "../utils/MathUtils.h"
+#include "GridTraversal.h"
 #include <algorithm>
 #include <cmath>
 #include <immintrin.h>
 
 LightSystem::LightSystem()
-    : m_flashlightEnabled(true)
+    : m_lightCount(0)
+    , m_dynamicLightCount(0)
+    , m_lightsChanged(false)
+    , m_time(0.0f)
+    , m_revision(0)
+    , m_lightGridWidth(0)
+    , m_lightGridHeight(0)
+    , m_visibilityCacheSize(0)
+    , m_visibilityWidth(0)
+    , m_visibilityHeight(0)
+    , m_visibilityGeneration(1)
+    , m_flashlightEnabled(true)
     , m_flashlightBattery(100.0f)
     , m_flashlightRadius(12.0f)
     , m_flashlightAngle(1.2f)
+    , m_flashlightCosAngle(std::cos(1.2f))
     , m_flashlightDrainRate(3.0f)
     , m_ambientLight(0.03f)
+    , m_lightmapWidth(0)
+    , m_lightmapHeight(0)
+    , m_bakedLightingEnabled(true)
+    , m_shadowDepth(nullptr)
+    , m_shadowColumns(0)
+    , m_shadowDirX(1.0f)
+    , m_shadowDirY(0.0f)
+    , m_shadowTanHalfFov(1.0f)
+    , m_bakeStop(false)
+    , m_bakeBatch(0)
+    , m_bakeInFlight(0)
+    , m_mapSnapshotRevision(0)
 {
 }
 
+LightSystem::~LightSystem()
+{
+    stopBakeWorkers();
+}
+
 void LightSystem::addRoomLights(const Map& map)
 {
     clearLights();
@@ -24,58 +54,984 @@ void LightSystem::addRoomLights(const Map& map)
     
     for (const auto& room : rooms)
     {
-        float centerX = room.x + room.width / 2.0f;
-        float centerY = room.y + room.height / 2.0f;
-        
-        float radius = std::max(room.width, room.height) * 1.5f;
+        float centerX = room.x + room.width / 2.0f;
+        float centerY = room.y + room.height / 2.0f;
+        
+        float radius = std::max(room.width, room.height) * 1.5f;
+        
+        sf::Color lightColor = room.isExit ? sf::Color(255, 215, 100) : sf::Color(255, 240, 200);
+        
+        addLight(Light(centerX, centerY, radius, 2.0f, lightColor, true));
+    }
+    
+    buildLightGrid(map);
+    buildPolarShadowMaps(map);
+    resetVisibilityCache(map);
+    bakeLightmap(map);
+}
+
+int LightSystem::addLight(const Light& light)
+{
+    LightInfo info;
+    info.radius = light.radius;
+    info.tint[0] = light.color.r / 255.0f;
+    info.tint[1] = light.color.g / 255.0f;
+    info.tint[2] = light.color.b / 255.0f;
+    info.isStatic = light.isStatic;
+    info.baseIntensity = light.intensity;
+    info.flickerAmount = 0.0f;
+    info.flickerSpeed = 0.0f;
+    
+    if (!light.isStatic)
+        m_dynamicLightCount++;
+    
+    // a removed light's slot first, the padding stays as it is
+    for (int idx = 0; idx < m_lightCount; ++idx)
+    {
+        if (m_lightInfo[idx].radius != 0.0f)
+            continue;
+        
+        m_lightX[idx] = light.x;
+        m_lightY[idx] = light.y;
+        m_lightRadiusSq[idx] = light.radius * light.radius;
+        m_lightInvRadius[idx] = 1.0f / light.radius;
+        m_lightIntensity[idx] = light.intensity;
+        
+        info.flickerPhase = idx * 2.4f;
+        m_lightInfo[idx] = info;
+        return idx;
+    }
+    
+    // drop the padding, append, pad again
+    m_lightX.resize(m_lightCount);
+    m_lightY.resize(m_lightCount);
+    m_lightRadiusSq.resize(m_lightCount);
+    m_lightInvRadius.resize(m_lightCount);
+    m_lightIntensity.resize(m_lightCount);
+    
+    m_lightX.push_back(light.x);
+    m_lightY.push_back(light.y);
+    m_lightRadiusSq.push_back(light.radius * light.radius);
+    m_lightInvRadius.push_back(1.0f / light.radius);
+    m_lightIntensity.push_back(light.intensity);
+    
+    info.flickerPhase = m_lightCount * 2.4f;
+    m_lightInfo.push_back(info);
+    
+    m_lightCount++;
+    
+    // zero radius - every distance test fails, so padding lanes never contribute
+    size_t padded = (static_cast<size_t>(m_lightCount) + 7) & ~static_cast<size_t>(7);
+    m_lightX.resize(padded, 0.0f);
+    m_lightY.resize(padded, 0.0f);
+    m_lightRadiusSq.resize(padded, 0.0f);
+    m_lightInvRadius.resize(padded, 0.0f);
+    m_lightIntensity.resize(padded, 0.0f);
+    
+    return m_lightCount - 1;
+}
+
+int LightSystem::spawnLight(const Light& light)
+{
+    int idx = addLight(light);
+    
+    // the arrays indexed by light have to cover it before update() rebuilds the rest
+    if (light.isStatic && !m_polarDepth.empty())
+        m_polarDepth.resize(static_cast<size_t>(m_lightCount) * POLAR_BINS, 0.0f);
+    
+    // culling stays on - the new light counts as visible until the next updateVisibleLights
+    if (!m_lightVisible.empty())
+    {
+        m_lightVisible.resize(m_lightCount, 0);
+        
+        if (!m_lightVisible[idx])
+        {
+            m_visibleLightIndices.push_back(idx);
+            m_lightVisible[idx] = 1;
+        }
+    }
+    
+    markLightDirty(idx);
+    m_lightsChanged = true;
+    m_revision++;
+    return idx;
+}
+
+void LightSystem::moveLight(int light, float x, float y)
+{
+    if (light < 0 || light >= m_lightCount || m_lightInfo[light].radius == 0.0f)
+        return;
+    
+    markLightDirty(light);
+    m_lightX[light] = x;
+    m_lightY[light] = y;
+    markLightDirty(light);
+    
+    m_lightsChanged = true;
+    m_revision++;
+}
+
+void LightSystem::removeLight(int light)
+{
+    if (light < 0 || light >= m_lightCount || m_lightInfo[light].radius == 0.0f)
+        return;
+    
+    markLightDirty(light);
+    
+    if (!m_lightInfo[light].isStatic)
+        m_dynamicLightCount--;
+    
+    // back to a padding light until the slot is reused
+    m_lightRadiusSq[light] = 0.0f;
+    m_lightInvRadius[light] = 0.0f;
+    m_lightIntensity[light] = 0.0f;
+    m_lightInfo[light].radius = 0.0f;
+    m_lightInfo[light].flickerAmount = 0.0f;
+    
+    m_lightsChanged = true;
+    m_revision++;
+}
+
+void LightSystem::setLightIntensity(int light, float intensity)
+{
+    if (light < 0 || light >= m_lightCount || m_lightInfo[light].radius == 0.0f)
+        return;
+    
+    m_lightInfo[light].baseIntensity = intensity;
+    m_lightIntensity[light] = intensity;
+    
+    // shadows don't change, only the bake
+    if (m_lightInfo[light].isStatic)
+        addDirtyRegion(m_lightX[light], m_lightY[light], m_lightInfo[light].radius);
+    
+    m_revision++;
+}
+
+void LightSystem::setLightFlicker(int light, float amount, float speed)
+{
+    // a static light would rebake everything it reaches on every flicker step
+    if (light < 0 || light >= m_lightCount || m_lightInfo[light].radius == 0.0f || m_lightInfo[light].isStatic)
+        return;
+    
+    m_lightInfo[light].flickerAmount = MathUtils::clamp(amount, 0.0f, 1.0f);
+    m_lightInfo[light].flickerSpeed = speed;
+    
+    if (amount <= 0.0f)
+        setLightIntensity(light, m_lightInfo[light].baseIntensity);
+}
+
+void LightSystem::invalidateTile(int x, int y)
+{
+    m_dirtyTiles.push_back({ x, y });
+    m_revision++;
+}
+
+void LightSystem::markLightDirty(int light)
+{
+    const LightInfo& info = m_lightInfo[light];
+    
+    if (info.isStatic)
+    {
+        addDirtyRegion(m_lightX[light], m_lightY[light], info.radius);
+        m_polarDirty.push_back(light);
+    }
+    else
+    {
+        m_visibilityDirty.push_back({ light, m_lightX[light], m_lightY[light], info.radius });
+    }
+}
+
+void LightSystem::addDirtyRegion(float x, float y, float radius)
+{
+    TileRect rect;
+    rect.x0 = static_cast<int>(std::floor(x - radius));
+    rect.y0 = static_cast<int>(std::floor(y - radius));
+    rect.x1 = static_cast<int>(std::ceil(x + radius));
+    rect.y1 = static_cast<int>(std::ceil(y + radius));
+    m_dirtyRegions.push_back(rect);
+}
+
+void LightSystem::clearLightVisibility(int light, float x, float y, float radius)
+{
+    int slot = light < static_cast<int>(m_visibilitySlot.size()) ? m_visibilitySlot[light] : -1;
+    if (slot < 0 || !m_visibilityCache)
+        return;
+    
+    // generation 0 is never current, so this reads as unknown
+    int minX = std::max(0, static_cast<int>(std::floor(x - radius)));
+    int maxX = std::min(m_visibilityWidth - 1, static_cast<int>(std::floor(x + radius)));
+    int minY = std::max(0, static_cast<int>(std::floor(y - radius)));
+    int maxY = std::min(m_visibilityHeight - 1, static_cast<int>(std::floor(y + radius)));
+    
+    size_t tileCount = static_cast<size_t>(m_visibilityWidth) * m_visibilityHeight;
+    
+    for (int tileY = minY; tileY <= maxY; ++tileY)
+    {
+        for (int tileX = minX; tileX <= maxX; ++tileX)
+            m_visibilityCache[slot * tileCount + tileY * m_visibilityWidth + tileX].store(0, std::memory_order_relaxed);
+    }
+}
+
+void LightSystem::update(float deltaTime, const Map& map)
+{
+    m_time += deltaTime;
+    
+    // flicker: two detuned sines, irregular enough for a failing lamp. culled lights light nothing
+    // on screen, so they hold still - otherwise one lamp anywhere would relight every frame
+    bool useAllLights = m_lightVisible.empty();
+    
+    for (int idx = 0; idx < m_lightCount; ++idx)
+    {
+        const LightInfo& info = m_lightInfo[idx];
+        if (info.flickerAmount <= 0.0f || info.radius == 0.0f || (!useAllLights && !m_lightVisible[idx]))
+            continue;
+        
+        float phase = m_time * info.flickerSpeed + info.flickerPhase;
+        float wave = 0.5f + 0.25f * std::sin(phase) + 0.25f * std::sin(phase * 2.7f + 1.3f);
+        m_lightIntensity[idx] = info.baseIntensity * (1.0f - info.flickerAmount * wave);
+        m_revision++;
+    }
+    
+    // changed tiles: the tile's own texels (and the wall texels around them), plus everything
+    // of each light that reaches it - its rays may pass through
+    for (const std::pair<int, int>& tile : m_dirtyTiles)
+    {
+        float tileX = static_cast<float>(tile.first);
+        float tileY = static_cast<float>(tile.second);
+        addDirtyRegion(tileX + 0.5f, tileY + 0.5f, 1.5f);
+        
+        for (int idx = 0; idx < m_lightCount; ++idx)
+        {
+            float dx = m_lightX[idx] - MathUtils::clamp(m_lightX[idx], tileX, tileX + 1.0f);
+            float dy = m_lightY[idx] - MathUtils::clamp(m_lightY[idx], tileY, tileY + 1.0f);
+            
+            if (dx * dx + dy * dy < m_lightRadiusSq[idx])
+                markLightDirty(idx);
+        }
+    }
+    m_dirtyTiles.clear();
+    
+    if (m_lightsChanged)
+    {
+        buildLightGrid(map);
+        
+        if (!m_polarDepth.empty())
+            m_polarDepth.resize(static_cast<size_t>(m_lightCount) * POLAR_BINS, 0.0f);
+        
+        // a new dynamic light needs a cache slot, which means a bigger cache
+        bool slotMissing = m_visibilitySlot.size() != static_cast<size_t>(m_lightCount);
+        for (int idx = 0; idx < m_lightCount && !slotMissing; ++idx)
+            slotMissing = !m_lightInfo[idx].isStatic && m_visibilitySlot[idx] < 0;
+        
+        if (slotMissing)
+            resetVisibilityCache(map);
+        
+        m_lightsChanged = false;
+    }
+    
+    std::sort(m_polarDirty.begin(), m_polarDirty.end());
+    m_polarDirty.erase(std::unique(m_polarDirty.begin(), m_polarDirty.end()), m_polarDirty.end());
+    
+    for (int idx : m_polarDirty)
+    {
+        if (!m_polarDepth.empty() && m_lightInfo[idx].isStatic && m_lightInfo[idx].radius > 0.0f)
+            buildPolarShadowMap(map, idx);
+    }
+    m_polarDirty.clear();
+    
+    for (const DirtyCircle& circle : m_visibilityDirty)
+        clearLightVisibility(circle.light, circle.x, circle.y, circle.radius);
+    m_visibilityDirty.clear();
+    
+    applyBakes();
+    
+    if (m_bakeInFlight == 0 && !m_dirtyRegions.empty())
+        dispatchBakes(map);
+}
+
+void LightSystem::buildLightGrid(const Map& map)
+{
+    m_lightGridWidth = map.getWidth();
+    m_lightGridHeight = map.getHeight();
+    
+    const int cellCount = m_lightGridWidth * m_lightGridHeight;
+    
+    // every cell the light's circle touches, from its bounding box
+    auto forEachCell = [&](int idx, auto&& visit)
+    {
+        float lightX = m_lightX[idx];
+        float lightY = m_lightY[idx];
+        float radius = m_lightInfo[idx].radius;
+        
+        int minX = std::max(0, static_cast<int>(std::floor(lightX - radius)));
+        int maxX = std::min(m_lightGridWidth - 1, static_cast<int>(std::floor(lightX + radius)));
+        int minY = std::max(0, static_cast<int>(std::floor(lightY - radius)));
+        int maxY = std::min(m_lightGridHeight - 1, static_cast<int>(std::floor(lightY + radius)));
+        
+        for (int cy = minY; cy <= maxY; ++cy)
+        {
+            for (int cx = minX; cx <= maxX; ++cx)
+            {
+                // closest point of the cell to the light
+                float dx = lightX - MathUtils::clamp(lightX, static_cast<float>(cx), cx + 1.0f);
+                float dy = lightY - MathUtils::clamp(lightY, static_cast<float>(cy), cy + 1.0f);
+                
+                if (dx * dx + dy * dy < m_lightRadiusSq[idx])
+                    visit(cy * m_lightGridWidth + cx);
+            }
+        }
+    };
+    
+    // count, prefix sum, fill
+    auto buildGrid = [&](std::vector<int>& start, std::vector<int>& indices, bool dynamicOnly)
+    {
+        start.assign(cellCount + 1, 0);
+        
+        for (int idx = 0; idx < m_lightCount; ++idx)
+        {
+            if (!dynamicOnly || !m_lightInfo[idx].isStatic)
+                forEachCell(idx, [&](int cell) { start[cell + 1]++; });
+        }
+        
+        for (int cell = 0; cell < cellCount; ++cell)
+            start[cell + 1] += start[cell];
+        
+        indices.resize(start[cellCount]);
+        std::vector<int> cursor(start.begin(), start.end() - 1);
+        
+        for (int idx = 0; idx < m_lightCount; ++idx)
+        {
+            if (!dynamicOnly || !m_lightInfo[idx].isStatic)
+                forEachCell(idx, [&](int cell) { indices[cursor[cell]++] = idx; });
+        }
+    };
+    
+    buildGrid(m_lightGridStart, m_lightGridIndices, false);
+    buildGrid(m_dynamicGridStart, m_dynamicGridIndices, true);
+}
+
+void LightSystem::resetVisibilityCache(const Map& map)
+{
+    // static lights read their polar map instead, so with only room lights there are no slots
+    // and the cache stays empty - it serves dynamic lights (and static ones if polar maps are off)
+    m_visibilitySlot.assign(m_lightCount, -1);
+    int slots = 0;
+    
+    for (int i = 0; i < m_lightCount; ++i)
+    {
+        if (!m_lightInfo[i].isStatic || m_polarDepth.empty())
+            m_visibilitySlot[i] = slots++;
+    }
+    
+    m_visibilityWidth = map.getWidth();
+    m_visibilityHeight = map.getHeight();
+    
+    size_t size = static_cast<size_t>(slots) * m_visibilityWidth * m_visibilityHeight;
+    
+    if (size != m_visibilityCacheSize)
+    {
+        m_visibilityCache.reset(size > 0 ? new std::atomic<uint8_t>[size]() : nullptr);
+        m_visibilityCacheSize = size;
+        m_visibilityGeneration = 1;
+    }
+    else
+    {
+        clearVisibilityCache();
+    }
+}
+
+void LightSystem::clearVisibilityCache()
+{
+    m_visibilityGeneration++;
+    
+    // 7-bit generation wrapped - old entries could alias, wipe them for real
+    if (m_visibilityGeneration > 127)
+    {
+        for (size_t i = 0; i < m_visibilityCacheSize; ++i)
+            m_visibilityCache[i].store(0, std::memory_order_relaxed);
+        
+        m_visibilityGeneration = 1;
+    }
+}
+
+// distance along a unit ray to the first wall, or maxDistance if there is none before it
+static float wallDistanceAlong(const Map& map, float posX, float posY, float dirX, float dirY, float maxDistance)
+{
+    GridTraversal::Walker walker(posX, posY, dirX, dirY);
+    
+    while (walker.nextBoundary() < maxDistance)
+    {
+        float distance = walker.step();
+        
+        if (map.isSolidFast(walker.mapX, walker.mapY))
+            return distance;
+        
+        int freeRadius = map.getWallDistance(walker.mapX, walker.mapY) - 1;
+        
+        if (freeRadius >= 2)
+            walker.skipEmptySpace(freeRadius, posX, posY, dirX, dirY);
+    }
+    
+    return maxDistance;
+}
+
+// squared falloff to zero at the radius
+static inline float lightFalloff(float intensity, float invRadius, float distanceSq)
+{
+    float attenuation = 1.0f - MathUtils::fast_sqrt(distanceSq) * invRadius;
+    return intensity * attenuation * attenuation;
+}
+
+void LightSystem::buildPolarShadowMaps(const Map& map)
+{
+    const int lightCount = m_lightCount;
+    m_polarDepth.assign(static_cast<size_t>(lightCount) * POLAR_BINS, 0.0f);
+    
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < lightCount * POLAR_BINS; ++i)
+    {
+        int idx = i / POLAR_BINS;
+        float angle = static_cast<float>(i % POLAR_BINS) * MathUtils::TWO_PI / static_cast<float>(POLAR_BINS);
+        
+        // nothing past the radius is lit anyway
+        m_polarDepth[i] = wallDistanceAlong(map, m_lightX[idx], m_lightY[idx], std::cos(angle), std::sin(angle),
+                                            m_lightInfo[idx].radius + 1.0f);
+    }
+}
+
+void LightSystem::buildPolarShadowMap(const Map& map, int lightIdx)
+{
+    float* depth = &m_polarDepth[static_cast<size_t>(lightIdx) * POLAR_BINS];
+    
+    for (int bin = 0; bin < POLAR_BINS; ++bin)
+    {
+        float angle = static_cast<float>(bin) * MathUtils::TWO_PI / static_cast<float>(POLAR_BINS);
+        depth[bin] = wallDistanceAlong(map, m_lightX[lightIdx], m_lightY[lightIdx], std::cos(angle), std::sin(angle),
+                                       m_lightInfo[lightIdx].radius + 1.0f);
+    }
+}
+
+bool LightSystem::isVisibleFromLight(int lightIdx, float x, float y, const Map& map) const
+{
+    if (!m_lightInfo[lightIdx].isStatic || m_polarDepth.empty())
+        return hasLineOfSightCached(lightIdx, x, y, map);
+    
+    float dx = x - m_lightX[lightIdx];
+    float dy = y - m_lightY[lightIdx];
+    
+    float angle = std::atan2(dy, dx);
+    if (angle < 0.0f)
+        angle += MathUtils::TWO_PI;
+    
+    float position = angle * (POLAR_BINS / MathUtils::TWO_PI);
+    int bin0 = static_cast<int>(position) % POLAR_BINS;
+    int bin1 = (bin0 + 1) % POLAR_BINS;
+    
+    const float* depth = &m_polarDepth[lightIdx * POLAR_BINS];
+    float distance = MathUtils::fast_distance(dx, dy);
+    
+    // the two bins straddle an occluder edge - interpolating would leak light past it, so march
+    float binWidth = distance * (MathUtils::TWO_PI / POLAR_BINS);
+    if (std::abs(depth[bin0] - depth[bin1]) > binWidth)
+        return GridTraversal::lineOfSight(map, m_lightX[lightIdx], m_lightY[lightIdx], x, y);
+    
+    float fraction = position - std::floor(position);
+    float wallDistance = depth[bin0] + (depth[bin1] - depth[bin0]) * fraction;
+    
+    const float shadowBias = 0.05f;
+    return distance <= wallDistance + shadowBias;
+}
+
+std::vector<LightSystem::BakeLight> LightSystem::collectBakeLights() const
+{
+    std::vector<BakeLight> lights;
+    
+    for (int idx = 0; idx < m_lightCount; ++idx)
+    {
+        const LightInfo& info = m_lightInfo[idx];
+        if (!info.isStatic || info.radius == 0.0f)
+            continue;
+        
+        BakeLight light;
+        light.x = m_lightX[idx];
+        light.y = m_lightY[idx];
+        light.radius = info.radius;
+        light.radiusSq = m_lightRadiusSq[idx];
+        light.invRadius = m_lightInvRadius[idx];
+        light.intensity = m_lightIntensity[idx];
+        light.tint[0] = info.tint[0];
+        light.tint[1] = info.tint[1];
+        light.tint[2] = info.tint[2];
+        lights.push_back(light);
+    }
+    
+    return lights;
+}
+
+void LightSystem::bakeRegion(const Map& map, const std::vector<BakeLight>& lights, LightmapRegion& region, bool parallel)
+{
+    const int res = LIGHTMAP_RESOLUTION;
+    const int width = map.getWidth() * res;
+    const int height = map.getHeight() * res;
+    
+    // plane 0 is plain intensity, 1-3 the same tinted by each light's color
+    const int planeCount = 4;
+    
+    // raw light over the region and one texel around it, which the wall dilation reads
+    const int rawX0 = std::max(region.x0 - 1, 0);
+    const int rawY0 = std::max(region.y0 - 1, 0);
+    const int rawX1 = std::min(region.x1 + 1, width);
+    const int rawY1 = std::min(region.y1 + 1, height);
+    const int rawWidth = rawX1 - rawX0;
+    const int rawHeight = rawY1 - rawY0;
+    
+    std::vector<float> planes[planeCount];
+    
+    for (std::vector<float>& plane : planes)
+        plane.assign(static_cast<size_t>(rawWidth) * rawHeight, 0.0f);
+    
+    // texel centers, exact LOS batched per light and row - rows are independent
+    #pragma omp parallel if (parallel)
+    {
+        std::vector<float> targetX(rawWidth);
+        std::vector<float> targetY(rawWidth);
+        std::vector<float> falloff(rawWidth);
+        std::vector<int> column(rawWidth);
+        std::vector<unsigned char> visible(rawWidth);
+        
+        #pragma omp for schedule(dynamic, 4)
+        for (int row = 0; row < rawHeight; ++row)
+        {
+            int ty = rawY0 + row;
+            float y = (ty + 0.5f) / res;
+            
+            for (const BakeLight& light : lights)
+            {
+                if (std::abs(y - light.y) >= light.radius)
+                    continue;
+                
+                int firstColumn = std::max(rawX0, static_cast<int>((light.x - light.radius) * res));
+                int lastColumn = std::min(rawX1 - 1, static_cast<int>((light.x + light.radius) * res));
+                int count = 0;
+                
+                for (int tx = firstColumn; tx <= lastColumn; ++tx)
+                {
+                    if (map.isWall(tx / res, ty / res))
+                        continue;
+                    
+                    float x = (tx + 0.5f) / res;
+                    float dx = x - light.x;
+                    float dy = y - light.y;
+                    float distanceSq = dx * dx + dy * dy;
+                    
+                    if (distanceSq >= light.radiusSq)
+                        continue;
+                    
+                    targetX[count] = x;
+                    targetY[count] = y;
+                    falloff[count] = lightFalloff(light.intensity, light.invRadius, distanceSq);
+                    column[count] = tx - rawX0;
+                    count++;
+                }
+                
+                GridTraversal::lineOfSightBatch(map, light.x, light.y, targetX.data(), targetY.data(), count, visible.data());
+                
+                const float tint[planeCount] = { 1.0f, light.tint[0], light.tint[1], light.tint[2] };
+                
+                for (int i = 0; i < count; ++i)
+                {
+                    if (!visible[i])
+                        continue;
+                    
+                    for (int p = 0; p < planeCount; ++p)
+                        planes[p][row * rawWidth + column[i]] += falloff[i] * tint[p];
+                }
+            }
+        }
+    }
+    
+    // wall texels take the average of their open neighbours so bilinear
+    // fetches on a wall face don't get pulled down by the dark inside
+    const int regionWidth = region.x1 - region.x0;
+    const int regionHeight = region.y1 - region.y0;
+    
+    for (std::vector<float>& plane : region.planes)
+        plane.resize(static_cast<size_t>(regionWidth) * regionHeight);
+    
+    #pragma omp parallel for schedule(static) if (parallel)
+    for (int ty = region.y0; ty < region.y1; ++ty)
+    {
+        for (int tx = region.x0; tx < region.x1; ++tx)
+        {
+            size_t out = static_cast<size_t>(ty - region.y0) * regionWidth + (tx - region.x0);
+            
+            for (int p = 0; p < planeCount; ++p)
+                region.planes[p][out] = planes[p][(ty - rawY0) * rawWidth + (tx - rawX0)];
+            
+            if (!map.isWall(tx / res, ty / res))
+                continue;
+            
+            float sum[planeCount] = {};
+            int count = 0;
+            
+            for (int ny = std::max(ty - 1, 0); ny <= std::min(ty + 1, height - 1); ++ny)
+            {
+                for (int nx = std::max(tx - 1, 0); nx <= std::min(tx + 1, width - 1); ++nx)
+                {
+                    if (!map.isWall(nx / res, ny / res))
+                    {
+                        for (int p = 0; p < planeCount; ++p)
+                            sum[p] += planes[p][(ny - rawY0) * rawWidth + (nx - rawX0)];
+                        ++count;
+                    }
+                }
+            }
+            
+            if (count > 0)
+            {
+                for (int p = 0; p < planeCount; ++p)
+                    region.planes[p][out] = sum[p] / count;
+            }
+        }
+    }
+}
+
+void LightSystem::bakeLightmap(const Map& map)
+{
+    LightmapRegion region;
+    region.x0 = 0;
+    region.y0 = 0;
+    region.x1 = map.getWidth() * LIGHTMAP_RESOLUTION;
+    region.y1 = map.getHeight() * LIGHTMAP_RESOLUTION;
+    region.batch = m_bakeBatch;
+    
+    bakeRegion(map, collectBakeLights(), region, true);
+    
+    m_lightmap = std::move(region.planes[0]);
+    for (int c = 0; c < 3; ++c)
+        m_lightmapColor[c] = std::move(region.planes[c + 1]);
+    
+    m_lightmapWidth = region.x1;
+    m_lightmapHeight = region.y1;
+}
+
+void LightSystem::dispatchBakes(const Map& map)
+{
+    // nothing baked yet - the first bake is the whole map, right away
+    if (m_lightmap.empty())
+    {
+        bakeLightmap(map);
+        m_dirtyRegions.clear();
+        m_revision++;
+        return;
+    }
+    
+    // merge overlapping rects so no texel is baked twice in a batch
+    std::vector<TileRect>& rects = m_dirtyRegions;
+    
+    for (bool merged = true; merged; )
+    {
+        merged = false;
+        
+        for (size_t i = 0; i < rects.size() && !merged; ++i)
+        {
+            for (size_t j = i + 1; j < rects.size(); ++j)
+            {
+                if (rects[i].x0 < rects[j].x1 && rects[j].x0 < rects[i].x1 &&
+                    rects[i].y0 < rects[j].y1 && rects[j].y0 < rects[i].y1)
+                {
+                    rects[i].x0 = std::min(rects[i].x0, rects[j].x0);
+                    rects[i].y0 = std::min(rects[i].y0, rects[j].y0);
+                    rects[i].x1 = std::max(rects[i].x1, rects[j].x1);
+                    rects[i].y1 = std::max(rects[i].y1, rects[j].y1);
+                    rects.erase(rects.begin() + j);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+    }
+    
+    // the workers read copies - the map can change again before they're done
+    if (!m_mapSnapshot || m_mapSnapshotRevision != map.getRevision())
+    {
+        m_mapSnapshot = std::make_shared<const Map>(map);
+        m_mapSnapshotRevision = map.getRevision();
+    }
+    auto lights = std::make_shared<const std::vector<BakeLight>>(collectBakeLights());
+    
+    if (m_bakeWorkers.empty())
+    {
+        m_bakeStop = false;
+        for (int i = 0; i < BAKE_WORKERS; ++i)
+            m_bakeWorkers.emplace_back(&LightSystem::bakeWorker, this);
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(m_bakeMutex);
+        
+        for (const TileRect& rect : rects)
+        {
+            BakeJob job;
+            job.map = m_mapSnapshot;
+            job.lights = lights;
+            
+            // one texel more around it: wall texels just outside average texels that changed
+            job.region.x0 = std::max(rect.x0 * LIGHTMAP_RESOLUTION - 1, 0);
+            job.region.y0 = std::max(rect.y0 * LIGHTMAP_RESOLUTION - 1, 0);
+            job.region.x1 = std::min(rect.x1 * LIGHTMAP_RESOLUTION + 1, m_lightmapWidth);
+            job.region.y1 = std::min(rect.y1 * LIGHTMAP_RESOLUTION + 1, m_lightmapHeight);
+            job.region.batch = m_bakeBatch;
+            
+            if (job.region.x0 >= job.region.x1 || job.region.y0 >= job.region.y1)
+                continue;
+            
+            m_bakeQueue.push_back(std::move(job));
+            m_bakeInFlight++;
+        }
+    }
+    m_bakeCondition.notify_all();
+    
+    m_dirtyRegions.clear();
+}
+
+void LightSystem::applyBakes()
+{
+    std::vector<LightmapRegion> results;
+    {
+        std::lock_guard<std::mutex> lock(m_bakeMutex);
+        results.swap(m_bakeResults);
+    }
+    
+    for (const LightmapRegion& region : results)
+    {
+        if (region.batch != m_bakeBatch)
+            continue;
+        
+        m_bakeInFlight--;
+        
+        std::vector<float>* planes[4] = { &m_lightmap, &m_lightmapColor[0], &m_lightmapColor[1], &m_lightmapColor[2] };
+        int regionWidth = region.x1 - region.x0;
+        
+        for (int p = 0; p < 4; ++p)
+        {
+            for (int ty = region.y0; ty < region.y1; ++ty)
+            {
+                std::copy_n(&region.planes[p][static_cast<size_t>(ty - region.y0) * regionWidth], regionWidth,
+                            &(*planes[p])[static_cast<size_t>(ty) * m_lightmapWidth + region.x0]);
+            }
+        }
+        
+        m_revision++;
+    }
+}
+
+void LightSystem::bakeWorker()
+{
+    for (;;)
+    {
+        BakeJob job;
+        {
+            std::unique_lock<std::mutex> lock(m_bakeMutex);
+            m_bakeCondition.wait(lock, [&] { return m_bakeStop || !m_bakeQueue.empty(); });
+            
+            if (m_bakeStop)
+                return;
+            
+            job = std::move(m_bakeQueue.front());
+            m_bakeQueue.pop_front();
+        }
         
-        sf::Color lightColor = room.isExit ? sf::Color(255, 215, 100) : sf::Color(255, 240, 200);
+        // serial - the render threads keep the cores
+        bakeRegion(*job.map, *job.lights, job.region, false);
         
-        m_staticLights.emplace_back(centerX, centerY, radius, 2.0f, lightColor, true);
+        std::lock_guard<std::mutex> lock(m_bakeMutex);
+        m_bakeResults.push_back(std::move(job.region));
+    }
+}
+
+void LightSystem::stopBakeWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_bakeMutex);
+        m_bakeStop = true;
     }
+    m_bakeCondition.notify_all();
+    
+    for (std::thread& worker : m_bakeWorkers)
+        worker.join();
+    m_bakeWorkers.clear();
+}
+
+float LightSystem::sampleLightmap(const std::vector<float>& plane, float x, float y) const
+{
+    // bilinear between the four nearest texel centers
+    float u = x * LIGHTMAP_RESOLUTION - 0.5f;
+    float v = y * LIGHTMAP_RESOLUTION - 0.5f;
+    
+    u = MathUtils::clamp(u, 0.0f, m_lightmapWidth - 1.001f);
+    v = MathUtils::clamp(v, 0.0f, m_lightmapHeight - 1.001f);
+    
+    int x0 = static_cast<int>(u);
+    int y0 = static_cast<int>(v);
+    float fx = u - x0;
+    float fy = v - y0;
+    
+    const float* row0 = &plane[y0 * m_lightmapWidth + x0];
+    const float* row1 = row0 + m_lightmapWidth;
+    
+    float top = row0[0] + (row0[1] - row0[0]) * fx;
+    float bottom = row1[0] + (row1[1] - row1[0]) * fx;
+    
+    return top + (bottom - top) * fy;
 }
 
 void LightSystem::clearLights()
 {
-    m_staticLights.clear();
+    m_lightX.clear();
+    m_lightY.clear();
+    m_lightRadiusSq.clear();
+    m_lightInvRadius.clear();
+    m_lightIntensity.clear();
+    m_lightInfo.clear();
+    m_lightCount = 0;
+    m_dynamicLightCount = 0;
+    
+    m_lightsChanged = false;
+    m_polarDirty.clear();
+    m_visibilityDirty.clear();
+    m_dirtyTiles.clear();
+    m_revision++;
+    
+    // bakes still running belong to the old lights (and maybe the old map)
+    {
+        std::lock_guard<std::mutex> lock(m_bakeMutex);
+        m_bakeQueue.clear();
+        m_bakeResults.clear();
+    }
+    m_bakeBatch++;
+    m_bakeInFlight = 0;
+    m_dirtyRegions.clear();
+    m_mapSnapshot.reset();
+    
     m_visibleLightIndices.clear();
-    m_visibilityCache.clear();
+    m_lightVisible.clear();
+    m_lightGridStart.clear();
+    m_lightGridIndices.clear();
+    m_dynamicGridStart.clear();
+    m_dynamicGridIndices.clear();
+    m_lightGridWidth = 0;
+    m_lightGridHeight = 0;
+    m_visibilitySlot.clear();
+    clearVisibilityCache();
+    
+    m_polarDepth.clear();
+    m_lightmap.clear();
+    for (std::vector<float>& plane : m_lightmapColor)
+        plane.clear();
+    m_lightmapWidth = 0;
+    m_lightmapHeight = 0;
 }
 
-void LightSystem::updateVisibleLights(const Player& player)
+void LightSystem::updateVisibleLights(const Player& player, const Map& map)
 {
     m_visibleLightIndices.clear();
-    m_visibilityCache.clear();  // clear cache each frame
+    m_lightVisible.clear();
     
-    float playerAngle = player.getAngle();
     float playerX = player.getX();
     float playerY = player.getY();
     
-    // FOV for culling (wider than actual FOV to catch edge lights)
-    const float cullFOV = MathUtils::PI * 0.8f;  // ~144 degrees
+    int startRegion = map.getRegion(static_cast<int>(std::floor(playerX)), static_cast<int>(std::floor(playerY)));
+    if (startRegion < 0)
+        return;  // inside a wall - no culling
+    
+    float maxRadius = 0.0f;
+    for (int i = 0; i < m_lightCount; ++i)
+        maxRadius = std::max(maxRadius, m_lightInfo[i].radius);
+    
+    const float budget = LIGHT_CULL_DISTANCE + maxRadius;
+    
+    // Dijkstra over the portals. regions are rectangles, so a straight line between two points in
+    // one is open and the distances between the portal edges give a lower bound of any real path
+    const std::vector<Region>& regions = map.getRegions();
+    const std::vector<Portal>& portals = map.getPortals();
     
-    for (int i = 0; i < static_cast<int>(m_staticLights.size()); ++i)
+    auto byDistance = [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first > b.first; };
+    
+    m_portalDistance.assign(portals.size(), budget + 1.0f);
+    m_portalQueue.clear();
+    
+    for (int portal : regions[startRegion].portals)
+    {
+        float distance = portals[portal].distanceTo(playerX, playerY);
+        if (distance <= budget)
+        {
+            m_portalDistance[portal] = distance;
+            m_portalQueue.push_back({ distance, portal });
+        }
+    }
+    std::make_heap(m_portalQueue.begin(), m_portalQueue.end(), byDistance);
+    
+    while (!m_portalQueue.empty())
     {
-        const Light& light = m_staticLights[i];
+        std::pop_heap(m_portalQueue.begin(), m_portalQueue.end(), byDistance);
+        auto [distance, current] = m_portalQueue.back();
+        m_portalQueue.pop_back();
         
-        float dx = light.x - playerX;
-        float dy = light.y - playerY;
-        float distSq = dx * dx + dy * dy;
+        if (distance > m_portalDistance[current])
+            continue;  // stale entry
         
-        // skip if too far
-        float maxDist = light.radius + 20.0f;
-        if (distSq > maxDist * maxDist)
-            continue;
+        const Portal& from = portals[current];
+        
+        // on through both sides - the one we came from just finds nothing shorter
+        for (int region : { from.regionA, from.regionB })
+        {
+            for (int next : regions[region].portals)
+            {
+                const Portal& to = portals[next];
+                
+                // axis-aligned edges: the closest pair always involves an endpoint
+                float gap = std::min(std::min(to.distanceTo(from.x0, from.y0), to.distanceTo(from.x1, from.y1)),
+                                     std::min(from.distanceTo(to.x0, to.y0), from.distanceTo(to.x1, to.y1)));
+                
+                float total = distance + gap;
+                if (total < m_portalDistance[next])
+                {
+                    m_portalDistance[next] = total;
+                    m_portalQueue.push_back({ total, next });
+                    std::push_heap(m_portalQueue.begin(), m_portalQueue.end(), byDistance);
+                }
+            }
+        }
+    }
+    
+    m_lightVisible.assign(m_lightCount, 0);
+    
+    for (int i = 0; i < m_lightCount; ++i)
+    {
+        float reach = LIGHT_CULL_DISTANCE + m_lightInfo[i].radius;
+        
+        int region = map.getRegion(static_cast<int>(std::floor(m_lightX[i])), static_cast<int>(std::floor(m_lightY[i])));
         
-        // frustum check - is light in front of player?
-        float angleToLight = std::atan2(dy, dx);
-        float angleDiff = MathUtils::normalize_angle(angleToLight - playerAngle);
+        float distance;
+        if (region < 0 || region == startRegion)
+        {
+            // same room as the player (or a light inside a wall): the straight line
+            float dx = m_lightX[i] - playerX;
+            float dy = m_lightY[i] - playerY;
+            distance = std::sqrt(dx * dx + dy * dy);
+        }
+        else
+        {
+            distance = budget + 1.0f;
+            for (int portal : regions[region].portals)
+                distance = std::min(distance, m_portalDistance[portal] + portals[portal].distanceTo(m_lightX[i], m_lightY[i]));
+        }
         
-        // include if within extended FOV OR very close (might be behind but still visible on walls)
-        float dist = std::sqrt(distSq);
-        if (std::abs(angleDiff) < cullFOV || dist < light.radius)
+        if (distance <= reach)
         {
             m_visibleLightIndices.push_back(i);
+            m_lightVisible[i] = 1;
         }
     }
 }
@@ -102,248 +1058,538 @@ void LightSystem::updateFlashlight(float deltaTime, bool isUsing, bool inSafeRoo
     }
 }
 
+void LightSystem::setFlashlightShadowMap(const float* columnDepth, int columns, float viewDirX, float viewDirY, float tanHalfFov)
+{
+    m_shadowDepth = columnDepth;
+    m_shadowColumns = columns;
+    m_shadowDirX = viewDirX;
+    m_shadowDirY = viewDirY;
+    m_shadowTanHalfFov = tanHalfFov;
+}
+
+bool LightSystem::isLitByFlashlight(float x, float y, const Player& player, const Map& map) const
+{
+    if (m_shadowDepth != nullptr)
+    {
+        float dx = x - player.getX();
+        float dy = y - player.getY();
+        
+        // view space, then the same column mapping the raycaster uses
+        float forward = dx * m_shadowDirX + dy * m_shadowDirY;
+        
+        if (forward > 0.0f)
+        {
+            float lateral = dy * m_shadowDirX - dx * m_shadowDirY;
+            float cameraX = lateral / (forward * m_shadowTanHalfFov);
+            int column = static_cast<int>(std::floor((cameraX + 1.0f) * 0.5f * m_shadowColumns + 0.5f));
+            
+            if (column >= 0 && column < m_shadowColumns)
+            {
+                // small bias so points on the wall face itself stay lit
+                const float shadowBias = 0.05f;
+                return forward <= m_shadowDepth[column] + shadowBias;
+            }
+        }
+    }
+    
+    // outside the view (or no depth buffer this frame) - march
+    return hasLineOfSight(player.getX(), player.getY(), x, y, map);
+}
+
 bool LightSystem::hasLineOfSight(float x1, float y1, float x2, float y2, const Map& map) const
 {
-    float dx = x2 - x1;
-    float dy = y2 - y1;
+    return GridTraversal::lineOfSight(map, x1, y1, x2, y2);
+}
+
+bool LightSystem::hasLineOfSightCached(int lightIdx, float x2, float y2, const Map& map) const
+{
+    const float lightX = m_lightX[lightIdx];
+    const float lightY = m_lightY[lightIdx];
     
-    float distance = MathUtils::fast_distance(dx, dy);
+    int slot = lightIdx < static_cast<int>(m_visibilitySlot.size()) ? m_visibilitySlot[lightIdx] : -1;
+    int tileX = static_cast<int>(x2);
+    int tileY = static_cast<int>(y2);
+    
+    // wall tiles are only ever hit on their faces, and the tile center answer would be wrong there
+    if (slot < 0 || tileX < 0 || tileX >= m_visibilityWidth || tileY < 0 || tileY >= m_visibilityHeight ||
+        map.isSolidFast(tileX, tileY))
+    {
+        return hasLineOfSight(lightX, lightY, x2, y2, map);
+    }
+    
+    size_t tileCount = static_cast<size_t>(m_visibilityWidth) * m_visibilityHeight;
+    std::atomic<uint8_t>& entry = m_visibilityCache[slot * tileCount + tileY * m_visibilityWidth + tileX];
+    
+    uint8_t value = entry.load(std::memory_order_relaxed);
+    if ((value >> 1) == m_visibilityGeneration)
+        return (value & 1) != 0;
+    
+    // threads racing on the same tile compute the same answer, so last store wins harmlessly
+    bool visible = hasLineOfSight(lightX, lightY, tileX + 0.5f, tileY + 0.5f, map);
+    entry.store(static_cast<uint8_t>((m_visibilityGeneration << 1) | (visible ? 1 : 0)), std::memory_order_relaxed);
+    
+    return visible;
+}
+
+float LightSystem::staticLightContribution(int lightIdx, float x, float y, const Map& map) const
+{
+    float dx = x - m_lightX[lightIdx];
+    float dy = y - m_lightY[lightIdx];
+    
+    float distanceSq = dx * dx + dy * dy;
+    
+    if (distanceSq >= m_lightRadiusSq[lightIdx] || !isVisibleFromLight(lightIdx, x, y, map))
+        return 0.0f;
+    
+    return lightFalloff(m_lightIntensity[lightIdx], m_lightInvRadius[lightIdx], distanceSq);
+}
+
+float LightSystem::directLighting(float x, float y, const Map& map, bool dynamicOnly) const
+{
+    float total = 0.0f;
     
-    if (distance < 0.1f)
-        return true;
+    int cellX = static_cast<int>(x);
+    int cellY = static_cast<int>(y);
     
-    float dirX = dx / distance;
-    float dirY = dy / distance;
+    if (cellX < 0 || cellX >= m_lightGridWidth || cellY < 0 || cellY >= m_lightGridHeight)
+        return total;
     
-    float checkDist = distance - 0.1f;
-    if (checkDist < 0.1f)
-        return true;
+    // only lights reaching this cell, and of those the culled ones if culling ran
+    const std::vector<int>& gridStart = dynamicOnly ? m_dynamicGridStart : m_lightGridStart;
+    const std::vector<int>& gridIndices = dynamicOnly ? m_dynamicGridIndices : m_lightGridIndices;
     
-    int steps = static_cast<int>(checkDist) + 1;
+    int cell = cellY * m_lightGridWidth + cellX;
+    bool useAllLights = m_lightVisible.empty();
     
-    for (int i = 0; i <= steps; ++i)
+    for (int i = gridStart[cell]; i < gridStart[cell + 1]; ++i)
     {
-        float t = static_cast<float>(i) / static_cast<float>(steps);
-        float checkX = x1 + dirX * checkDist * t;
-        float checkY = y1 + dirY * checkDist * t;
+        int idx = gridIndices[i];
         
-        if (map.isWall(static_cast<int>(checkX), static_cast<int>(checkY)))
-        {
-            return false;
-        }
+        if (useAllLights || m_lightVisible[idx])
+            total += staticLightContribution(idx, x, y, map);
     }
     
-    return true;
+    return total;
 }
 
-bool LightSystem::hasLineOfSightCached(int lightIdx, float x2, float y2, const Map& map) const
+float LightSystem::flashlightContribution(float x, float y, const Player& player, const Map& map) const
 {
-    // just call regular version - cache disabled for thread safety with OpenMP
-    const Light& light = m_staticLights[lightIdx];
-    return hasLineOfSight(light.x, light.y, x2, y2, map);
+    float dx = x - player.getX();
+    float dy = y - player.getY();
+    float distanceSq = dx * dx + dy * dy;
+    float radiusSq = m_flashlightRadius * m_flashlightRadius;
+    
+    if (distanceSq >= radiusSq || distanceSq <= 0.0001f)
+        return 0.0f;
+    
+    // cone test against the view direction - no atan2
+    float distance = std::sqrt(distanceSq);
+    float cosAngle = (dx * player.getDirX() + dy * player.getDirY()) / distance;
+    
+    if (cosAngle <= m_flashlightCosAngle || !isLitByFlashlight(x, y, player, map))
+        return 0.0f;
+    
+    float distanceAttenuation = 1.0f - (distance / m_flashlightRadius);
+    distanceAttenuation = distanceAttenuation * distanceAttenuation * distanceAttenuation;
+    
+    float angleDiff = MathUtils::fast_acos(std::min(cosAngle, 1.0f));
+    float angleAttenuation = 1.0f - (angleDiff / m_flashlightAngle);
+    angleAttenuation = angleAttenuation * angleAttenuation;
+    
+    float batteryMultiplier = m_flashlightBattery / 100.0f;
+    if (m_flashlightBattery < 20.0f)
+    {
+        batteryMultiplier *= 0.5f + 0.5f * std::sin(m_flashlightBattery * 10.0f);
+    }
+    
+    return distanceAttenuation * angleAttenuation * batteryMultiplier * 2.5f;
 }
 
 float LightSystem::calculateLighting(float x, float y, const Player& player, const Map& map) const
 {
     float totalLight = m_ambientLight;
     
-    // use frustum-culled lights if available, otherwise check all
-    const std::vector<int>& lightsToCheck = m_visibleLightIndices;
-    bool useAllLights = lightsToCheck.empty();
-    
-    if (useAllLights)
+    if (m_bakedLightingEnabled && !m_lightmap.empty())
     {
-        // fallback - check all lights
-        for (int idx = 0; idx < static_cast<int>(m_staticLights.size()); ++idx)
-        {
-            const Light& light = m_staticLights[idx];
-            
-            float dx = x - light.x;
-            float dy = y - light.y;
-            
-            float distanceSq = dx * dx + dy * dy;
-            float radiusSq = light.radius * light.radius;
-            
-            if (distanceSq < radiusSq)
-            {
-                if (hasLineOfSight(light.x, light.y, x, y, map))
-                {
-                    float distance = MathUtils::fast_sqrt(distanceSq);
-                    float attenuation = 1.0f - (distance / light.radius);
-                    attenuation = attenuation * attenuation;
-                    
-                    totalLight += light.intensity * attenuation;
-                }
-            }
-        }
+        // dynamic lights are never baked
+        totalLight += sampleLightmap(m_lightmap, x, y);
+        
+        if (m_dynamicLightCount > 0)
+            totalLight += directLighting(x, y, map, true);
     }
     else
     {
-        // use frustum-culled lights
-        for (int idx : lightsToCheck)
-        {
-            const Light& light = m_staticLights[idx];
-            
-            float dx = x - light.x;
-            float dy = y - light.y;
-            
-            float distanceSq = dx * dx + dy * dy;
-            float radiusSq = light.radius * light.radius;
-            
-            if (distanceSq < radiusSq)
-            {
-                if (hasLineOfSightCached(idx, x, y, map))
-                {
-                    float distance = MathUtils::fast_sqrt(distanceSq);
-                    float attenuation = 1.0f - (distance / light.radius);
-                    attenuation = attenuation * attenuation;
-                    
-                    totalLight += light.intensity * attenuation;
-                }
-            }
-        }
+        totalLight += directLighting(x, y, map, false);
     }
     
-    // flashlight
     if (m_flashlightEnabled && m_flashlightBattery > 0.0f)
     {
-        float dx = x - player.getX();
-        float dy = y - player.getY();
-        float distanceSq = dx * dx + dy * dy;
-        float radiusSq = m_flashlightRadius * m_flashlightRadius;
+        totalLight += flashlightContribution(x, y, player, map);
+    }
+    
+    return MathUtils::clamp(totalLight, 0.0f, 1.0f);
+}
+
+void LightSystem::calculateLightingBatch(const float* x, const float* y, float* results, int count,
+                                         const Player& player, const Map& map) const
+{
+    float* channels[1] = { results };
+    lightBatch(x, y, channels, 1, count, player, map);
+}
+
+void LightSystem::calculateLightingBatchRGB(const float* x, const float* y, float* red, float* green, float* blue, int count,
+                                            const Player& player, const Map& map) const
+{
+    float* channels[3] = { red, green, blue };
+    lightBatch(x, y, channels, 3, count, player, map);
+}
+
+void LightSystem::lightBatch(const float* x, const float* y, float* const* channels, int channelCount, int count,
+                             const Player& player, const Map& map) const
+{
+    // blocks are big enough to amortize per-light setup, small enough to balance threads
+    const int blockSize = 256;
+    const int blockCount = (count + blockSize - 1) / blockSize;
+    
+    bool baked = m_bakedLightingEnabled && !m_lightmap.empty();
+    bool flashlightOn = m_flashlightEnabled && m_flashlightBattery > 0.0f;
+    
+    #pragma omp parallel
+    {
+        // candidate lights of the direct path, one list per thread, reused by all of its blocks
+        std::vector<int> candidates;
+        candidates.reserve(m_lightCount);
         
-        if (distanceSq < radiusSq && distanceSq > 0.0001f)
+        #pragma omp for schedule(dynamic, 1)
+        for (int block = 0; block < blockCount; ++block)
         {
-            float angleToPoint = std::atan2(dy, dx);
-            float playerAngle = player.getAngle();
-            float angleDiff = MathUtils::normalize_angle(angleToPoint - playerAngle);
+            int begin = block * blockSize;
+            int pointCount = std::min(count, begin + blockSize) - begin;
             
-            if (std::abs(angleDiff) < m_flashlightAngle)
+            const float* blockX = x + begin;
+            const float* blockY = y + begin;
+            float* blockChannels[3];
+            
+            for (int c = 0; c < channelCount; ++c)
             {
-                if (hasLineOfSight(player.getX(), player.getY(), x, y, map))
-                {
-                    float distance = MathUtils::fast_sqrt(distanceSq);
-                    
-                    float distanceAttenuation = 1.0f - (distance / m_flashlightRadius);
-                    distanceAttenuation = distanceAttenuation * distanceAttenuation * distanceAttenuation;
-                    
-                    float angleAttenuation = 1.0f - (std::abs(angleDiff) / m_flashlightAngle);
-                    angleAttenuation = angleAttenuation * angleAttenuation;
-                    
-                    float batteryMultiplier = m_flashlightBattery / 100.0f;
-                    if (m_flashlightBattery < 20.0f)
-                    {
-                        batteryMultiplier *= 0.5f + 0.5f * std::sin(m_flashlightBattery * 10.0f);
-                    }
-                    
-                    totalLight += distanceAttenuation * angleAttenuation * batteryMultiplier * 2.5f;
-                }
+                blockChannels[c] = channels[c] + begin;
+                
+                for (int i = 0; i < pointCount; ++i)
+                    blockChannels[c][i] = m_ambientLight;
+            }
+            
+            if (baked)
+            {
+                sampleLightmapBlock(blockX, blockY, blockChannels, channelCount, pointCount);
+                
+                if (m_dynamicLightCount > 0)
+                    accumulateStaticLightsBlock(blockX, blockY, blockChannels, channelCount, pointCount, map, true, candidates);
+            }
+            else
+            {
+                accumulateStaticLightsBlock(blockX, blockY, blockChannels, channelCount, pointCount, map, false, candidates);
+            }
+            
+            if (flashlightOn)
+                accumulateFlashlightBlock(blockX, blockY, blockChannels, channelCount, pointCount, player, map);
+            
+            for (int c = 0; c < channelCount; ++c)
+            {
+                for (int i = 0; i < pointCount; ++i)
+                    blockChannels[c][i] = MathUtils::clamp(blockChannels[c][i], 0.0f, 1.0f);
             }
         }
     }
-    
-    return MathUtils::clamp(totalLight, 0.0f, 1.0f);
 }
 
-// SIMD version - process 4 points at once
-void LightSystem::calculateLighting4(const float* px, const float* py, float* results,
-                                     const Player& player, const Map& map) const
+void LightSystem::accumulateFlashlightBlock(const float* x, const float* y, float* const* channels, int channelCount, int count,
+                                           const Player& player, const Map& map) const
 {
-#ifdef __AVX__
-    __m128 totalLight = _mm_set1_ps(m_ambientLight);
-    __m128 pointX = _mm_loadu_ps(px);
-    __m128 pointY = _mm_loadu_ps(py);
+    int i = 0;
+    
+#ifdef __AVX2__
+    const float playerX = player.getX();
+    const float playerY = player.getY();
+    
+    float batteryMultiplier = m_flashlightBattery / 100.0f;
+    if (m_flashlightBattery < 20.0f)
+    {
+        batteryMultiplier *= 0.5f + 0.5f * std::sin(m_flashlightBattery * 10.0f);
+    }
+    
+    const __m256 originX = _mm256_set1_ps(playerX);
+    const __m256 originY = _mm256_set1_ps(playerY);
+    const __m256 dirX = _mm256_set1_ps(player.getDirX());
+    const __m256 dirY = _mm256_set1_ps(player.getDirY());
+    const __m256 radiusSq = _mm256_set1_ps(m_flashlightRadius * m_flashlightRadius);
+    const __m256 minDistanceSq = _mm256_set1_ps(0.0001f);
+    const __m256 cosThreshold = _mm256_set1_ps(m_flashlightCosAngle);
+    const __m256 invRadius = _mm256_set1_ps(1.0f / m_flashlightRadius);
+    const __m256 invAngle = _mm256_set1_ps(1.0f / m_flashlightAngle);
+    const __m256 scale = _mm256_set1_ps(batteryMultiplier * 2.5f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    
+    // shadow map lookup, same mapping as isLitByFlashlight
+    const bool hasShadowMap = m_shadowDepth != nullptr;
+    const __m256 shadowDirX = _mm256_set1_ps(m_shadowDirX);
+    const __m256 shadowDirY = _mm256_set1_ps(m_shadowDirY);
+    const __m256 tanHalfFov = _mm256_set1_ps(m_shadowTanHalfFov);
+    const __m256 halfColumns = _mm256_set1_ps(0.5f * m_shadowColumns);
+    const __m256 columns = _mm256_set1_ps(static_cast<float>(m_shadowColumns));
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 shadowBias = _mm256_set1_ps(0.05f);
     
-    // process visible lights
-    for (int idx : m_visibleLightIndices)
+    for (; i + 8 <= count; i += 8)
     {
-        const Light& light = m_staticLights[idx];
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), originX);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), originY);
+        __m256 distanceSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
         
-        __m128 lightX = _mm_set1_ps(light.x);
-        __m128 lightY = _mm_set1_ps(light.y);
-        __m128 radius = _mm_set1_ps(light.radius);
-        __m128 radiusSq = _mm_mul_ps(radius, radius);
-        __m128 intensity = _mm_set1_ps(light.intensity);
+        __m256 distance = _mm256_sqrt_ps(distanceSq);
+        __m256 cosAngle = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(dx, dirX), _mm256_mul_ps(dy, dirY)), distance);
         
-        __m128 dx = _mm_sub_ps(pointX, lightX);
-        __m128 dy = _mm_sub_ps(pointY, lightY);
-        __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m256 active = _mm256_and_ps(_mm256_cmp_ps(distanceSq, radiusSq, _CMP_LT_OQ),
+                                      _mm256_cmp_ps(distanceSq, minDistanceSq, _CMP_GT_OQ));
+        active = _mm256_and_ps(active, _mm256_cmp_ps(cosAngle, cosThreshold, _CMP_GT_OQ));
         
-        // mask for points within radius
-        __m128 inRange = _mm_cmplt_ps(distSq, radiusSq);
+        int activeBits = _mm256_movemask_ps(active);
+        if (activeBits == 0)
+            continue;
         
-        // check if any point is in range
-        int mask = _mm_movemask_ps(inRange);
-        if (mask == 0) continue;
+        // visibility: depth compare where the point projects onto the screen, LOS march elsewhere
+        __m256 resolved = zero;
+        __m256 lit = zero;
         
-        // calculate attenuation for all 4 (will mask out later)
-        __m128 dist = _mm_sqrt_ps(distSq);
-        __m128 invRadius = _mm_div_ps(_mm_set1_ps(1.0f), radius);
-        __m128 atten = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(dist, invRadius));
-        atten = _mm_mul_ps(atten, atten);  // squared falloff
+        if (hasShadowMap)
+        {
+            __m256 forward = _mm256_add_ps(_mm256_mul_ps(dx, shadowDirX), _mm256_mul_ps(dy, shadowDirY));
+            __m256 lateral = _mm256_sub_ps(_mm256_mul_ps(dy, shadowDirX), _mm256_mul_ps(dx, shadowDirY));
+            __m256 cameraX = _mm256_div_ps(lateral, _mm256_mul_ps(forward, tanHalfFov));
+            __m256 column = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(cameraX, one), halfColumns), half));
+            
+            resolved = _mm256_and_ps(active, _mm256_cmp_ps(forward, zero, _CMP_GT_OQ));
+            resolved = _mm256_and_ps(resolved, _mm256_cmp_ps(column, zero, _CMP_GE_OQ));
+            resolved = _mm256_and_ps(resolved, _mm256_cmp_ps(column, columns, _CMP_LT_OQ));
+            
+            __m256i columnIndex = _mm256_and_si256(_mm256_cvttps_epi32(column), _mm256_castps_si256(resolved));
+            __m256 depth = _mm256_mask_i32gather_ps(zero, m_shadowDepth, columnIndex, resolved, 4);
+            
+            lit = _mm256_and_ps(resolved, _mm256_cmp_ps(forward, _mm256_add_ps(depth, shadowBias), _CMP_LE_OQ));
+        }
         
-        // check visibility for each point that's in range
-        float attenArr[4];
-        _mm_storeu_ps(attenArr, atten);
+        int fallbackBits = activeBits & ~_mm256_movemask_ps(resolved);
         
-        for (int i = 0; i < 4; ++i)
+        if (fallbackBits != 0)
         {
-            if ((mask & (1 << i)) && hasLineOfSightCached(idx, px[i], py[i], map))
+            alignas(32) float fallback[8] = {};
+            
+            for (int lane = 0; lane < 8; ++lane)
             {
-                results[i] += light.intensity * attenArr[i];
+                if ((fallbackBits & (1 << lane)) && hasLineOfSight(playerX, playerY, x[i + lane], y[i + lane], map))
+                    fallback[lane] = 1.0f;
             }
+            
+            lit = _mm256_or_ps(lit, _mm256_cmp_ps(_mm256_load_ps(fallback), zero, _CMP_NEQ_OQ));
         }
+        
+        __m256 distanceAttenuation = _mm256_sub_ps(one, _mm256_mul_ps(distance, invRadius));
+        distanceAttenuation = _mm256_mul_ps(distanceAttenuation, _mm256_mul_ps(distanceAttenuation, distanceAttenuation));
+        
+        __m256 angleAttenuation = _mm256_sub_ps(one, _mm256_mul_ps(MathUtils::acos8_avx(_mm256_min_ps(cosAngle, one)), invAngle));
+        angleAttenuation = _mm256_mul_ps(angleAttenuation, angleAttenuation);
+        
+        __m256 contribution = _mm256_mul_ps(_mm256_mul_ps(distanceAttenuation, angleAttenuation), scale);
+        contribution = _mm256_and_ps(contribution, lit);
+        
+        // white light - same amount in every channel
+        for (int c = 0; c < channelCount; ++c)
+            _mm256_storeu_ps(channels[c] + i, _mm256_add_ps(_mm256_loadu_ps(channels[c] + i), contribution));
+    }
+#endif
+    
+    for (; i < count; ++i)
+    {
+        float contribution = flashlightContribution(x[i], y[i], player, map);
+        
+        for (int c = 0; c < channelCount; ++c)
+            channels[c][i] += contribution;
+    }
+}
+
+void LightSystem::sampleLightmapBlock(const float* x, const float* y, float* const* channels, int channelCount, int count) const
+{
+    const std::vector<float>* planes[3] = { &m_lightmap, nullptr, nullptr };
+    
+    if (channelCount == 3)
+    {
+        for (int c = 0; c < 3; ++c)
+            planes[c] = &m_lightmapColor[c];
     }
     
-    // store base results
-    _mm_storeu_ps(results, _mm_add_ps(_mm_loadu_ps(results), _mm_sub_ps(totalLight, _mm_set1_ps(m_ambientLight))));
+    int i = 0;
     
-    // flashlight - still scalar for now (complex angle math)
-    if (m_flashlightEnabled && m_flashlightBattery > 0.0f)
+#ifdef __AVX2__
+    // same bilinear fetch as sampleLightmap, four gathers per 8 points
+    const __m256 res = _mm256_set1_ps(static_cast<float>(LIGHTMAP_RESOLUTION));
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 maxU = _mm256_set1_ps(m_lightmapWidth - 1.001f);
+    const __m256 maxV = _mm256_set1_ps(m_lightmapHeight - 1.001f);
+    const __m256i width = _mm256_set1_epi32(m_lightmapWidth);
+    const __m256i one = _mm256_set1_epi32(1);
+    
+    for (; i + 8 <= count; i += 8)
     {
-        for (int i = 0; i < 4; ++i)
+        __m256 u = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(x + i), res), half);
+        __m256 v = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(y + i), res), half);
+        u = _mm256_min_ps(_mm256_max_ps(u, zero), maxU);
+        v = _mm256_min_ps(_mm256_max_ps(v, zero), maxV);
+        
+        __m256i x0 = _mm256_cvttps_epi32(u);
+        __m256i y0 = _mm256_cvttps_epi32(v);
+        __m256 fx = _mm256_sub_ps(u, _mm256_cvtepi32_ps(x0));
+        __m256 fy = _mm256_sub_ps(v, _mm256_cvtepi32_ps(y0));
+        
+        __m256i topIndex = _mm256_add_epi32(_mm256_mullo_epi32(y0, width), x0);
+        __m256i bottomIndex = _mm256_add_epi32(topIndex, width);
+        
+        // the weights are shared, only the gathers repeat per plane
+        for (int c = 0; c < channelCount; ++c)
         {
-            float dx = px[i] - player.getX();
-            float dy = py[i] - player.getY();
-            float distanceSq = dx * dx + dy * dy;
+            const float* lightmap = planes[c]->data();
             
-            if (distanceSq < m_flashlightRadius * m_flashlightRadius && distanceSq > 0.0001f)
-            {
-                float angleToPoint = std::atan2(dy, dx);
-                float angleDiff = MathUtils::normalize_angle(angleToPoint - player.getAngle());
-                
-                if (std::abs(angleDiff) < m_flashlightAngle)
-                {
-                    if (hasLineOfSight(player.getX(), player.getY(), px[i], py[i], map))
-                    {
-                        float distance = std::sqrt(distanceSq);
-                        float distAtten = 1.0f - (distance / m_flashlightRadius);
-                        distAtten = distAtten * distAtten * distAtten;
-                        
-                        float angleAtten = 1.0f - (std::abs(angleDiff) / m_flashlightAngle);
-                        angleAtten = angleAtten * angleAtten;
-                        
-                        float battery = m_flashlightBattery / 100.0f;
-                        if (m_flashlightBattery < 20.0f)
-                            battery *= 0.5f + 0.5f * std::sin(m_flashlightBattery * 10.0f);
-                        
-                        results[i] += distAtten * angleAtten * battery * 2.5f;
-                    }
-                }
-            }
+            __m256 topLeft = _mm256_i32gather_ps(lightmap, topIndex, 4);
+            __m256 topRight = _mm256_i32gather_ps(lightmap, _mm256_add_epi32(topIndex, one), 4);
+            __m256 bottomLeft = _mm256_i32gather_ps(lightmap, bottomIndex, 4);
+            __m256 bottomRight = _mm256_i32gather_ps(lightmap, _mm256_add_epi32(bottomIndex, one), 4);
+            
+            __m256 top = _mm256_add_ps(topLeft, _mm256_mul_ps(_mm256_sub_ps(topRight, topLeft), fx));
+            __m256 bottom = _mm256_add_ps(bottomLeft, _mm256_mul_ps(_mm256_sub_ps(bottomRight, bottomLeft), fx));
+            __m256 value = _mm256_add_ps(top, _mm256_mul_ps(_mm256_sub_ps(bottom, top), fy));
+            
+            _mm256_storeu_ps(channels[c] + i, _mm256_add_ps(_mm256_loadu_ps(channels[c] + i), value));
         }
     }
+#endif
+    
+    for (; i < count; ++i)
+    {
+        for (int c = 0; c < channelCount; ++c)
+            channels[c][i] += sampleLightmap(*planes[c], x[i], y[i]);
+    }
+}
+
+void LightSystem::accumulateStaticLightsBlock(const float* x, const float* y, float* const* channels, int channelCount, int count,
+                                             const Map& map, bool dynamicOnly, std::vector<int>& candidates) const
+{
+    if (count == 0)
+        return;
     
-    // clamp results
-    for (int i = 0; i < 4; ++i)
+    // block bounds, to drop lights that can't reach any of its points
+    float minX = x[0], maxX = x[0];
+    float minY = y[0], maxY = y[0];
+    
+    for (int i = 1; i < count; ++i)
     {
-        results[i] = MathUtils::clamp(results[i], 0.0f, 1.0f);
+        minX = std::min(minX, x[i]);
+        maxX = std::max(maxX, x[i]);
+        minY = std::min(minY, y[i]);
+        maxY = std::max(maxY, y[i]);
     }
-#else
-    // fallback - just call scalar version
-    for (int i = 0; i < 4; ++i)
+    
+    // candidates: the lights of every grid cell the bounds cover, deduplicated and back in light
+    // order, so the sums come out the same as walking all lights
+    const std::vector<int>& gridStart = dynamicOnly ? m_dynamicGridStart : m_lightGridStart;
+    const std::vector<int>& gridIndices = dynamicOnly ? m_dynamicGridIndices : m_lightGridIndices;
+    
+    int cellMinX = std::max(0, static_cast<int>(std::floor(minX)));
+    int cellMaxX = std::min(m_lightGridWidth - 1, static_cast<int>(std::floor(maxX)));
+    int cellMinY = std::max(0, static_cast<int>(std::floor(minY)));
+    int cellMaxY = std::min(m_lightGridHeight - 1, static_cast<int>(std::floor(maxY)));
+    
+    if (gridStart.empty() || cellMinX > cellMaxX || cellMinY > cellMaxY)
+        return;
+    
+    candidates.clear();
+    
+    for (int cy = cellMinY; cy <= cellMaxY; ++cy)
     {
-        results[i] = calculateLighting(px[i], py[i], player, map);
+        for (int cx = cellMinX; cx <= cellMaxX; ++cx)
+        {
+            int cell = cy * m_lightGridWidth + cx;
+            candidates.insert(candidates.end(), gridIndices.data() + gridStart[cell], gridIndices.data() + gridStart[cell + 1]);
+        }
     }
+    
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    
+    bool useAllLights = m_lightVisible.empty();
+    
+    for (int idx : candidates)
+    {
+        if (!useAllLights && !m_lightVisible[idx])
+            continue;
+        
+        float dx = m_lightX[idx] - MathUtils::clamp(m_lightX[idx], minX, maxX);
+        float dy = m_lightY[idx] - MathUtils::clamp(m_lightY[idx], minY, maxY);
+        if (dx * dx + dy * dy >= m_lightRadiusSq[idx])
+            continue;
+        
+        // gray takes the plain intensity, RGB the light's color
+        const float white[3] = { 1.0f, 1.0f, 1.0f };
+        const float* tint = channelCount == 3 ? m_lightInfo[idx].tint : white;
+        
+        int i = 0;
+        
+#ifdef __AVX2__
+        // everything per light is a broadcast straight from the hot arrays
+        const __m256 lightX = _mm256_broadcast_ss(&m_lightX[idx]);
+        const __m256 lightY = _mm256_broadcast_ss(&m_lightY[idx]);
+        const __m256 radiusSq = _mm256_broadcast_ss(&m_lightRadiusSq[idx]);
+        const __m256 invRadius = _mm256_broadcast_ss(&m_lightInvRadius[idx]);
+        const __m256 intensity = _mm256_broadcast_ss(&m_lightIntensity[idx]);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 px = _mm256_sub_ps(_mm256_loadu_ps(x + i), lightX);
+            __m256 py = _mm256_sub_ps(_mm256_loadu_ps(y + i), lightY);
+            __m256 distanceSq = _mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py));
+            
+            int inRange = _mm256_movemask_ps(_mm256_cmp_ps(distanceSq, radiusSq, _CMP_LT_OQ));
+            if (inRange == 0)
+                continue;
+            
+            __m256 attenuation = _mm256_sub_ps(one, _mm256_mul_ps(_mm256_sqrt_ps(distanceSq), invRadius));
+            attenuation = _mm256_mul_ps(intensity, _mm256_mul_ps(attenuation, attenuation));
+            
+            // visibility is a per-point lookup (polar map or cache)
+            alignas(32) float visible[8] = {};
+            
+            for (int lane = 0; lane < 8; ++lane)
+            {
+                if ((inRange & (1 << lane)) && isVisibleFromLight(idx, x[i + lane], y[i + lane], map))
+                    visible[lane] = 1.0f;
+            }
+            
+            attenuation = _mm256_mul_ps(attenuation, _mm256_load_ps(visible));
+            
+            for (int c = 0; c < channelCount; ++c)
+            {
+                __m256 tinted = _mm256_mul_ps(attenuation, _mm256_set1_ps(tint[c]));
+                _mm256_storeu_ps(channels[c] + i, _mm256_add_ps(_mm256_loadu_ps(channels[c] + i), tinted));
+            }
+        }
 #endif
+        
+        for (; i < count; ++i)
+        {
+            float contribution = staticLightContribution(idx, x[i], y[i], map);
+            
+            for (int c = 0; c < channelCount; ++c)
+                channels[c][i] += contribution * tint[c];
+        }
+    }
 }
@@ -1,8 +1,16 @@
 #pragma once
 #include <SFML/Graphics.hpp>
 #include <vector>
-#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <cstdint>
 #include <cmath>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include "../utils/MathUtils.h"
 
 class Player;
 class Map;
@@ -23,21 +31,61 @@ class LightSystem
 {
 public:
     LightSystem();
+    ~LightSystem();
+    
+    LightSystem(const LightSystem&) = delete;
+    LightSystem& operator=(const LightSystem&) = delete;
     
     float calculateLighting(float x, float y, const Player& player, const Map& map) const;
     
-    // batch version - process 4 points at once using SIMD
-    void calculateLighting4(const float* x, const float* y, float* results,
-                           const Player& player, const Map& map) const;
+    // batch version for a whole frame of sample points (structure of arrays). runs in parallel
+    // blocks, 8 points per vector, one light at a time over each block. results[i] matches
+    // calculateLighting(x[i], y[i], ...)
+    void calculateLightingBatch(const float* x, const float* y, float* results, int count,
+                                const Player& player, const Map& map) const;
+    
+    // colored version - each light adds its Light::color, ambient and flashlight are white.
+    // every channel is clamped like the gray result
+    void calculateLightingBatchRGB(const float* x, const float* y, float* red, float* green, float* blue, int count,
+                                   const Player& player, const Map& map) const;
     
     void addRoomLights(const Map& map);
     void clearLights();
     
-    // call once per frame to update frustum culling
-    void updateVisibleLights(const Player& player);
+    // runtime lights. the returned handle stays valid until removeLight (a removed slot is reused).
+    // static lights are baked: each change rebakes the lightmap around them in the background.
+    // dynamic ones (Light::isStatic = false) are lit directly through the tile visibility cache and
+    // can move or flicker every frame for free. changes take effect at the next update()
+    int spawnLight(const Light& light);
+    void moveLight(int light, float x, float y);
+    void removeLight(int light);
+    void setLightIntensity(int light, float intensity);
+    // amount 0..1 of the intensity, 0 = steady. dynamic lights only - a static one ignores it
+    void setLightFlicker(int light, float amount, float speed);
+    
+    // call after Map::setTile - drops the shadows and baked light of every light reaching the tile
+    void invalidateTile(int x, int y);
+    
+    // once per frame: flicker, rebuilds for the changes above, hands dirty lightmap regions to the
+    // bake workers and copies in whatever they finished
+    void update(float deltaTime, const Map& map);
+    
+    // bumped whenever lighting changes without the camera moving
+    unsigned int getRevision() const { return m_revision; }
     
-    // clear visibility cache (call when player moves significantly)
-    void clearVisibilityCache() { m_visibilityCache.clear(); }
+    // static lights are baked into a lightmap with LIGHTMAP_RESOLUTION texels per tile;
+    // when disabled every sample walks the lights directly
+    static constexpr int LIGHTMAP_RESOLUTION = 4;
+    void setBakedLighting(bool enabled) { m_bakedLightingEnabled = enabled; }
+    bool isBakedLightingEnabled() const { return m_bakedLightingEnabled; }
+    
+    // call once per frame to update light culling: floods the map's region graph from the
+    // player and keeps the lights whose shortest path stays within LIGHT_CULL_DISTANCE + radius
+    void updateVisibleLights(const Player& player, const Map& map);
+    static constexpr float LIGHT_CULL_DISTANCE = 20.0f;
+    
+    // forget cached light visibility (call when a cached light moves or the map changes)
+    void clearVisibilityCache();
     
     void setFlashlightEnabled(bool enabled) { m_flashlightEnabled = enabled; }
     bool isFlashlightEnabled() const { return m_flashlightEnabled; }
@@ -57,21 +105,194 @@ public:
     float getFlashlightRadius() const { return m_flashlightRadius; }
     float getFlashlightAngle() const { return m_flashlightAngle; }
     
+    // flashlight occlusion from the raycaster's depth buffer (perpendicular wall distance per
+    // column, for the current pose). points inside the view frustum then need a lookup
+    // instead of a LOS march. the buffer is not copied - clear it once lighting is done
+    void setFlashlightShadowMap(const float* columnDepth, int columns, float viewDirX, float viewDirY, float tanHalfFov);
+    void clearFlashlightShadowMap() { m_shadowDepth = nullptr; m_shadowColumns = 0; }
+    
 private:
-    std::vector<Light> m_staticLights;
-    std::vector<int> m_visibleLightIndices;  // frustum culled lights
+    // lights are split hot/cold. the hot arrays are all the lighting loops read: structure of
+    // arrays, 32-byte aligned and padded to a multiple of 8 with lights that reach nothing,
+    // derived values precomputed once when a light is added
+    using AlignedFloats = std::vector<float, MathUtils::AlignedAllocator<float>>;
+    AlignedFloats m_lightX;
+    AlignedFloats m_lightY;
+    AlignedFloats m_lightRadiusSq;
+    AlignedFloats m_lightInvRadius;
+    AlignedFloats m_lightIntensity;
+    int m_lightCount;  // real lights, the rest of the hot arrays is padding
+    
+    // cold side: touched when tinting, baking or rebuilding
+    struct LightInfo
+    {
+        float radius;   // 0 for a removed light - same as the padding
+        float tint[3];  // color as 0..1 per channel
+        bool isStatic;
+        float baseIntensity;
+        float flickerAmount;
+        float flickerSpeed;
+        float flickerPhase;
+    };
+    std::vector<LightInfo> m_lightInfo;
+    int m_dynamicLightCount;  // lights that are never baked
+    
+    int addLight(const Light& light);  // reuses a removed slot if there is one, returns the index
+    
+    // runtime changes, applied by update()
+    bool m_lightsChanged;                 // light grid and visibility slots need a rebuild
+    std::vector<int> m_polarDirty;        // static lights whose polar map is stale
+    struct DirtyCircle
+    {
+        int light;
+        float x, y, radius;               // where it used to reach, for the visibility cache
+    };
+    std::vector<DirtyCircle> m_visibilityDirty;
+    std::vector<std::pair<int, int>> m_dirtyTiles;
+    float m_time;
+    unsigned int m_revision;
+    
+    void markLightDirty(int light);      // its current reach, call before and after a change
+    void clearLightVisibility(int light, float x, float y, float radius);
+    
+    std::vector<int> m_visibleLightIndices;  // culled lights
+    std::vector<unsigned char> m_lightVisible;  // same, as a per-light mask. empty = culling off, use all
+    
+    // culling flood scratch: lower bound of the path length from the player to each portal
+    std::vector<float> m_portalDistance;
+    std::vector<std::pair<float, int>> m_portalQueue;  // min-heap of (distance, portal)
+    
+    // uniform light grid: the lights whose radius overlaps each map cell, CSR layout
+    // (cell i owns m_lightGridIndices[m_lightGridStart[i] .. m_lightGridStart[i + 1]])
+    std::vector<int> m_lightGridStart;
+    std::vector<int> m_lightGridIndices;
+    std::vector<int> m_dynamicGridStart;    // same, dynamic lights only (the baked path adds just these)
+    std::vector<int> m_dynamicGridIndices;
+    int m_lightGridWidth;
+    int m_lightGridHeight;
+    
+    void buildLightGrid(const Map& map);
+    
+    // tile visibility cache for lights without a polar map: one entry per (slot, tile), filled
+    // on demand from any thread. entry = generation << 1 | visible, older generations read as
+    // unknown, so a reset is just a generation bump
+    std::vector<int> m_visibilitySlot;  // light index -> cache slot, -1 if it has a polar map
+    std::unique_ptr<std::atomic<uint8_t>[]> m_visibilityCache;
+    size_t m_visibilityCacheSize;
+    int m_visibilityWidth;
+    int m_visibilityHeight;
+    uint8_t m_visibilityGeneration;  // 1..127
     
-    // visibility cache: key = (lightIdx << 20) | (tileX << 10) | tileY
-    mutable std::unordered_map<uint32_t, bool> m_visibilityCache;
+    void resetVisibilityCache(const Map& map);
     
     bool m_flashlightEnabled;
     float m_flashlightBattery;
     float m_flashlightRadius;
     float m_flashlightAngle;
+    float m_flashlightCosAngle;  // cone test threshold, cos(m_flashlightAngle)
     float m_flashlightDrainRate;
     
     float m_ambientLight;
     
+    // summed static light per texel (row-major, m_lightmapWidth x m_lightmapHeight)
+    std::vector<float> m_lightmap;
+    std::vector<float> m_lightmapColor[3];  // same with the light colors applied, one plane per RGB channel
+    int m_lightmapWidth;
+    int m_lightmapHeight;
+    bool m_bakedLightingEnabled;
+    
+    // flashlight shadow map (see setFlashlightShadowMap)
+    const float* m_shadowDepth;
+    int m_shadowColumns;
+    float m_shadowDirX;
+    float m_shadowDirY;
+    float m_shadowTanHalfFov;
+    
+    bool isLitByFlashlight(float x, float y, const Player& player, const Map& map) const;
+    
+    // polar shadow maps: wall distance around each static light, POLAR_BINS rays per light.
+    // built in addRoomLights and read-only afterwards, so threads share them freely
+    static constexpr int POLAR_BINS = 360;
+    std::vector<float> m_polarDepth;  // light index * POLAR_BINS + bin
+    
+    void buildPolarShadowMaps(const Map& map);
+    void buildPolarShadowMap(const Map& map, int lightIdx);
+    bool isVisibleFromLight(int lightIdx, float x, float y, const Map& map) const;
+    
+    // baking works on copies, so the workers never touch what the main thread changes
+    struct BakeLight
+    {
+        float x, y;
+        float radius;
+        float radiusSq;
+        float invRadius;
+        float intensity;
+        float tint[3];
+    };
+    
+    // texels [x0, x1) x [y0, y1) of the lightmap, planes row-major in the region: gray, then RGB
+    struct LightmapRegion
+    {
+        int x0, y0, x1, y1;
+        std::vector<float> planes[4];
+        unsigned int batch;
+    };
+    
+    struct BakeJob
+    {
+        std::shared_ptr<const Map> map;
+        std::shared_ptr<const std::vector<BakeLight>> lights;
+        LightmapRegion region;
+    };
+    
+    std::vector<BakeLight> collectBakeLights() const;
+    static void bakeRegion(const Map& map, const std::vector<BakeLight>& lights, LightmapRegion& region, bool parallel);
+    
+    void bakeLightmap(const Map& map);
+    float sampleLightmap(const std::vector<float>& plane, float x, float y) const;
+    
+    // dirty lightmap regions (tile rects, [x0, x1) x [y0, y1)) wait here until the previous batch
+    // is back, then go out together against one snapshot of the map and the lights
+    struct TileRect
+    {
+        int x0, y0, x1, y1;
+    };
+    std::vector<TileRect> m_dirtyRegions;
+    
+    void addDirtyRegion(float x, float y, float radius);
+    void dispatchBakes(const Map& map);
+    void applyBakes();
+    void bakeWorker();
+    void stopBakeWorkers();
+    
+    static constexpr int BAKE_WORKERS = 2;
+    std::vector<std::thread> m_bakeWorkers;  // started with the first job
+    std::mutex m_bakeMutex;
+    std::condition_variable m_bakeCondition;
+    std::deque<BakeJob> m_bakeQueue;
+    std::vector<LightmapRegion> m_bakeResults;
+    bool m_bakeStop;
+    unsigned int m_bakeBatch;   // results of an older batch (before clearLights) are dropped
+    int m_bakeInFlight;         // jobs of the current batch not applied yet (main thread only)
+    
+    std::shared_ptr<const Map> m_mapSnapshot;
+    unsigned int m_mapSnapshotRevision;
+    
+    float staticLightContribution(int lightIdx, float x, float y, const Map& map) const;
+    float directLighting(float x, float y, const Map& map, bool dynamicOnly) const;
+    float flashlightContribution(float x, float y, const Player& player, const Map& map) const;
+    
+    // batch core - channelCount is 1 (gray) or 3 (RGB)
+    void lightBatch(const float* x, const float* y, float* const* channels, int channelCount, int count,
+                    const Player& player, const Map& map) const;
+    
+    // batch helpers - one block of points, accumulated into every channel
+    void accumulateFlashlightBlock(const float* x, const float* y, float* const* channels, int channelCount, int count,
+                                   const Player& player, const Map& map) const;
+    void sampleLightmapBlock(const float* x, const float* y, float* const* channels, int channelCount, int count) const;
+    void accumulateStaticLightsBlock(const float* x, const float* y, float* const* channels, int channelCount, int count,
+                                     const Map& map, bool dynamicOnly, std::vector<int>& candidates) const;
+    
     bool hasLineOfSight(float x1, float y1, float x2, float y2, const Map& map) const;
     bool hasLineOfSightCached(int lightIdx, float x2, float y2, const Map& map) const;
 };
@@ -1,5 +1,6 @@
 #include "Raycaster.h"
 #include "LightSystem.h"
+#include "GridTraversal.h"
 #include "../world/Player.h"
 #include "../world/Map.h"
 #include "../core/Config.h"
@@ -7,197 +8,1128 @@
 #include <cmath>
 #include <algorithm>
 #include <omp.h>
+#include <immintrin.h>
 
 const float PI = MathUtils::PI;
 
 Raycaster::Raycaster(int screenWidth, int screenHeight)
-    : m_screenWidth(screenWidth)
+    : m_outputWidth(screenWidth)
+    , m_renderWidth(screenWidth)
     , m_screenHeight(screenHeight)
     , m_fov(PI / 3.0f)  // 60 deg
     , m_floorCeiling(sf::Quads)
     , m_wallSlices(sf::Quads)
+    , m_frameTextureReady(false)
     , m_lightingQuality(LightingQuality::HIGH)
+    , m_renderBackend(RenderBackend::VERTEX_ARRAY)
+    , m_dynamicResolution(false)
+    , m_frameBudget(0.0f)
+    , m_resolutionScale(1.0f)
+    , m_frameTimeIndex(0)
+    , m_frameTimeCount(0)
+    , m_framesSinceResize(0)
+    , m_lastKey()
+    , m_traceValid(false)
+    , m_lightingValid(false)
+    , m_outputValid(false)
+    , m_outputBackend(RenderBackend::VERTEX_ARRAY)
+    , m_angularGeneration(1)
+    , m_wallSpanTracing(false)
+    , m_cameraTableWidth(0)
+    , m_cameraTableFov(0.0f)
     , m_lastLighting(0.0f)
+    , m_temporalValid(false)
+    , m_temporalPending(false)
+    , m_historyWidth(0)
+    , m_historyChannels(0)
+    , m_historyX(0.0f)
+    , m_historyY(0.0f)
+    , m_historyDirX(1.0f)
+    , m_historyDirY(0.0f)
+    , m_temporalFrame(0)
+    , m_nearOriginX(0)
+    , m_nearOriginY(0)
 {
     // preallocate so we don't thrash memory every frame
+    // (sized for the full window - the render width never goes above it)
     m_floorCeiling.resize(screenWidth * 8);
     m_wallSlices.resize(screenWidth * 4);
     m_lightingBuffer.resize(screenWidth, 0.0f);
-    m_smoothedBuffer.resize(screenWidth, 0.0f);
+    m_columnDepth.resize(screenWidth, 0.0f);
+    // every sample of every column, plus all near cache nodes in the worst case
+    const int maxSamples = screenWidth * (MAX_LIGHT_SAMPLES + 1) + NEAR_CACHE_SIZE * NEAR_CACHE_SIZE;
+    m_sampleX.resize(maxSamples);
+    m_sampleY.resize(maxSamples);
+    for (std::vector<float>& channel : m_sampleLight)
+        channel.resize(maxSamples);
+    m_sampleSlot.resize(screenWidth * (MAX_LIGHT_SAMPLES + 1));
+    for (int c = 0; c < 3; ++c)
+    {
+        m_historyLight[c].resize(screenWidth);
+        m_nextHistoryLight[c].resize(screenWidth);
+    }
+    m_historyDepth.resize(screenWidth);
+    m_historyVertical.resize(screenWidth);
+    m_historyColumn.resize(screenWidth);
+    m_columnSamples.resize(screenWidth);
+    m_nearNodeSample.resize(NEAR_CACHE_SIZE * NEAR_CACHE_SIZE);
+    m_nearSamples.resize(screenWidth * MAX_LIGHT_SAMPLES);
+    m_litColumns.resize(screenWidth);
+    m_litBefore.resize(screenWidth);
+    for (std::vector<float>& channel : m_columnLight)
+        channel.resize(screenWidth);
     m_rayDataBuffer.resize(screenWidth);
+    m_columnHits.resize(screenWidth);
+    m_frameTimes.resize(16, 0.0f);
+    
+    // angular cache directions never change, only the hits do
+    m_binDirX.resize(ANGULAR_BINS);
+    m_binDirY.resize(ANGULAR_BINS);
+    m_angularHits.resize(ANGULAR_BINS);
+    m_angularStamp.resize(ANGULAR_BINS, 0);
+    
+    for (int bin = 0; bin < ANGULAR_BINS; ++bin)
+    {
+        float angle = static_cast<float>(bin) * MathUtils::TWO_PI / static_cast<float>(ANGULAR_BINS);
+        MathUtils::sincos_fast(angle, m_binDirY[bin], m_binDirX[bin]);
+    }
+    
+    buildCameraTable();
+}
+
+void Raycaster::setLightingQuality(LightingQuality quality)
+{
+    if (quality != m_lightingQuality)
+    {
+        m_lightingQuality = quality;
+        m_lightingValid = false;
+    }
+}
+
+void Raycaster::setWallSpanTracing(bool enabled)
+{
+    m_wallSpanTracing = enabled;
+    m_traceValid = false;
+}
+
+void Raycaster::invalidateHistory()
+{
+    // dropping the trace also forces a new angular cache generation on the next frame
+    m_traceValid = false;
+    m_lightingValid = false;
+    m_outputValid = false;
+    m_temporalValid = false;
+}
+
+void Raycaster::setDynamicResolution(bool enabled)
+{
+    m_dynamicResolution = enabled;
+    
+    if (!enabled)
+    {
+        m_resolutionScale = 1.0f;
+        setRenderWidth(m_outputWidth);
+    }
+}
+
+void Raycaster::setRenderWidth(int width)
+{
+    // keep whole ray packets
+    width = (width + 4) / 8 * 8;
+    m_renderWidth = std::max(8, std::min(m_outputWidth, width));
+    invalidateHistory();
 }
 
-Raycaster::RayHit Raycaster::castRay(float rayAngle, const Player& player, const Map& map)
+void Raycaster::updateResolutionScale(float frameTime)
+{
+    if (!m_dynamicResolution || m_frameBudget <= 0.0f)
+        return;
+    
+    const int windowSize = static_cast<int>(m_frameTimes.size());
+    
+    m_frameTimes[m_frameTimeIndex] = frameTime;
+    m_frameTimeIndex = (m_frameTimeIndex + 1) % windowSize;
+    m_frameTimeCount = std::min(m_frameTimeCount + 1, windowSize);
+    m_framesSinceResize++;
+    
+    // wait for a full window of frames at the current width before judging it
+    if (m_frameTimeCount < windowSize || m_framesSinceResize < windowSize)
+        return;
+    
+    float averageTime = 0.0f;
+    for (float time : m_frameTimes)
+        averageTime += time;
+    averageTime /= static_cast<float>(windowSize);
+    
+    const float minScale = 0.5f;
+    float newScale = m_resolutionScale;
+    
+    if (averageTime > m_frameBudget * 0.9f)
+    {
+        // over budget - drop roughly in proportion, but not more than 15% at once
+        newScale *= std::max(0.85f, (m_frameBudget * 0.8f) / averageTime);
+    }
+    else if (averageTime < m_frameBudget * 0.6f)
+    {
+        // plenty of headroom - creep back up
+        newScale += 0.05f;
+    }
+    
+    newScale = MathUtils::clamp(newScale, minScale, 1.0f);
+    
+    if (newScale != m_resolutionScale)
+    {
+        m_resolutionScale = newScale;
+        setRenderWidth(static_cast<int>(m_outputWidth * newScale));
+        m_framesSinceResize = 0;
+    }
+}
+
+void Raycaster::buildCameraTable()
+{
+    int paddedWidth = (m_renderWidth + 7) / 8 * 8;
+    
+    m_cameraCos.resize(paddedWidth);
+    m_cameraSin.resize(paddedWidth);
+    m_cameraAngle.resize(paddedWidth);
+    
+    float tanHalfFov = std::tan(m_fov / 2.0f);
+    
+    for (int x = 0; x < paddedWidth; ++x)
+    {
+        // pad the last packet by repeating the edge column
+        int column = std::min(x, m_renderWidth - 1);
+        float cameraX = 2.0f * column / static_cast<float>(m_renderWidth) - 1.0f;
+        float offset = std::atan(cameraX * tanHalfFov);
+        
+        m_cameraCos[x] = std::cos(offset);
+        m_cameraSin[x] = std::sin(offset);
+        m_cameraAngle[x] = offset;
+    }
+    
+    m_cameraTableWidth = m_renderWidth;
+    m_cameraTableFov = m_fov;
+    
+    invalidateHistory();
+}
+
+// turns the final DDA state into distance + hit point (shared by scalar and packet paths)
+void Raycaster::finishRay(RayHit& hit, float posX, float posY, float rayDirX, float rayDirY,
+                          int mapX, int mapY, int stepX, int stepY, int side)
+{
+    if (side == 0)
+    {
+        hit.distance = (mapX - posX + (1 - stepX) / 2) / rayDirX;
+        hit.hitVertical = true;
+        hit.hitX = posX + hit.distance * rayDirX;
+        hit.hitY = posY + hit.distance * rayDirY;
+    }
+    else
+    {
+        hit.distance = (mapY - posY + (1 - stepY) / 2) / rayDirY;
+        hit.hitVertical = false;
+        hit.hitX = posX + hit.distance * rayDirX;
+        hit.hitY = posY + hit.distance * rayDirY;
+    }
+    
+    hit.mapX = mapX;
+    hit.mapY = mapY;
+}
+
+Raycaster::RayHit Raycaster::castRay(float rayDirX, float rayDirY, const Player& player, const Map& map)
 {
     RayHit hit;
     hit.distance = 1000.0f;
     hit.hitVertical = false;
     
-    float rayDirX, rayDirY;
-    MathUtils::sincos_fast(rayAngle, rayDirY, rayDirX);
-    
     // DDA - the classic wolfenstein way
     float posX = player.getX();
     float posY = player.getY();
     
-    int mapX = static_cast<int>(posX);
-    int mapY = static_cast<int>(posY);
+    GridTraversal::Walker walker(posX, posY, rayDirX, rayDirY);
+    
+    // the map has a solid border, so this always terminates
+    while (true)
+    {
+        walker.step();
+        
+        if (map.isSolidFast(walker.mapX, walker.mapY))
+            break;
+        
+        // far from walls - skip the open box instead of stepping tile by tile
+        int freeRadius = map.getWallDistance(walker.mapX, walker.mapY) - 1;
+        
+        if (freeRadius >= 2)
+            walker.skipEmptySpace(freeRadius, posX, posY, rayDirX, rayDirY);
+    }
+    
+    finishRay(hit, posX, posY, rayDirX, rayDirY, walker.mapX, walker.mapY, walker.stepX, walker.stepY, walker.side);
+    
+    return hit;
+}
+
+void Raycaster::castRayPacket(const float* rayDirX, const float* rayDirY, const Player& player, const Map& map, RayHit* hits)
+{
+#ifdef __AVX2__
+    // same DDA as castRay, but 8 rays step in lockstep and lanes retire as they hit walls
+    float posX = player.getX();
+    float posY = player.getY();
+    
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 huge = _mm256_set1_ps(1e30f);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256i oneBit = _mm256_set1_epi32(1);
+    
+    __m256 vPosX = _mm256_set1_ps(posX);
+    __m256 vPosY = _mm256_set1_ps(posY);
+    __m256 vDirX = _mm256_loadu_ps(rayDirX);
+    __m256 vDirY = _mm256_loadu_ps(rayDirY);
+    
+    __m256i mapX = _mm256_set1_epi32(static_cast<int>(posX));
+    __m256i mapY = _mm256_set1_epi32(static_cast<int>(posY));
+    __m256 mapXf = _mm256_cvtepi32_ps(mapX);
+    __m256 mapYf = _mm256_cvtepi32_ps(mapY);
     
     // avoid div by zero with a big number
-    float deltaDistX = (rayDirX == 0) ? 1e30f : std::abs(1.0f / rayDirX);
-    float deltaDistY = (rayDirY == 0) ? 1e30f : std::abs(1.0f / rayDirY);
+    __m256 deltaDistX = _mm256_blendv_ps(_mm256_and_ps(_mm256_div_ps(one, vDirX), absMask), huge, _mm256_cmp_ps(vDirX, zero, _CMP_EQ_OQ));
+    __m256 deltaDistY = _mm256_blendv_ps(_mm256_and_ps(_mm256_div_ps(one, vDirY), absMask), huge, _mm256_cmp_ps(vDirY, zero, _CMP_EQ_OQ));
+    
+    __m256 negX = _mm256_cmp_ps(vDirX, zero, _CMP_LT_OQ);
+    __m256 negY = _mm256_cmp_ps(vDirY, zero, _CMP_LT_OQ);
+    
+    __m256i stepX = _mm256_blendv_epi8(_mm256_set1_epi32(1), _mm256_set1_epi32(-1), _mm256_castps_si256(negX));
+    __m256i stepY = _mm256_blendv_epi8(_mm256_set1_epi32(1), _mm256_set1_epi32(-1), _mm256_castps_si256(negY));
+    
+    __m256 sideDistX = _mm256_mul_ps(_mm256_blendv_ps(_mm256_sub_ps(_mm256_add_ps(mapXf, one), vPosX), _mm256_sub_ps(vPosX, mapXf), negX), deltaDistX);
+    __m256 sideDistY = _mm256_mul_ps(_mm256_blendv_ps(_mm256_sub_ps(_mm256_add_ps(mapYf, one), vPosY), _mm256_sub_ps(vPosY, mapYf), negY), deltaDistY);
     
-    int stepX, stepY;
-    float sideDistX, sideDistY;
+    // the padded occupancy grid has a solid border, so rays always stop before leaving it
+    const int* occupancy = reinterpret_cast<const int*>(map.getOccupancyData());
+    const __m256i stride = _mm256_set1_epi32(map.getOccupancyStride());
+    const __m256i pad = _mm256_set1_epi32(Map::OCCUPANCY_PAD);
+    const __m256i bitMask = _mm256_set1_epi32(31);
     
-    if (rayDirX < 0)
+    const int* wallDistance = reinterpret_cast<const int*>(map.getWallDistanceData());
+    const __m256i width = _mm256_set1_epi32(map.getWidth());
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const __m256i minSkipDistance = _mm256_set1_epi32(2);  // free radius >= 2
+    
+    __m256i active = _mm256_set1_epi32(-1);
+    __m256i side = _mm256_setzero_si256();  // 0 = vertical, 1 = horizontal
+    
+    while (!_mm256_testz_si256(active, active))
     {
-        stepX = -1;
-        sideDistX = (posX - mapX) * deltaDistX;
+        __m256i alongX = _mm256_and_si256(active, _mm256_castps_si256(_mm256_cmp_ps(sideDistX, sideDistY, _CMP_LT_OQ)));
+        __m256i alongY = _mm256_andnot_si256(alongX, active);
+        
+        sideDistX = _mm256_add_ps(sideDistX, _mm256_and_ps(deltaDistX, _mm256_castsi256_ps(alongX)));
+        sideDistY = _mm256_add_ps(sideDistY, _mm256_and_ps(deltaDistY, _mm256_castsi256_ps(alongY)));
+        mapX = _mm256_add_epi32(mapX, _mm256_and_si256(stepX, alongX));
+        mapY = _mm256_add_epi32(mapY, _mm256_and_si256(stepY, alongY));
+        side = _mm256_or_si256(_mm256_andnot_si256(active, side), _mm256_and_si256(alongY, oneBit));
+        
+        // one word gather + variable shift per lane, no bounds checks
+        __m256i bit = _mm256_add_epi32(mapX, pad);
+        __m256i row = _mm256_add_epi32(mapY, pad);
+        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(row, stride), _mm256_srli_epi32(bit, 5));
+        __m256i words = _mm256_i32gather_epi32(occupancy, index, 4);
+        __m256i solid = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(bit, bitMask)), oneBit);
+        
+        __m256i hitWall = _mm256_and_si256(active, _mm256_cmpeq_epi32(solid, oneBit));
+        active = _mm256_andnot_si256(hitWall, active);
+        
+        // lanes deep in open space jump across their empty box (see GridTraversal::Walker::skipEmptySpace)
+        __m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(mapY, width), mapX);
+        __m256i freeDistance = _mm256_and_si256(
+            _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), wallDistance, cell, active, 1), byteMask);
+        __m256i skip = _mm256_and_si256(active, _mm256_cmpgt_epi32(freeDistance, minSkipDistance));
+        
+        if (!_mm256_testz_si256(skip, skip))
+        {
+            __m256 radius = _mm256_cvtepi32_ps(_mm256_sub_epi32(freeDistance, oneBit));
+            __m256 cellX = _mm256_cvtepi32_ps(mapX);
+            __m256 cellY = _mm256_cvtepi32_ps(mapY);
+            
+            __m256 boxX = _mm256_blendv_ps(_mm256_add_ps(_mm256_add_ps(cellX, radius), one), _mm256_sub_ps(cellX, radius), negX);
+            __m256 boxY = _mm256_blendv_ps(_mm256_add_ps(_mm256_add_ps(cellY, radius), one), _mm256_sub_ps(cellY, radius), negY);
+            
+            __m256 exitT = _mm256_sub_ps(_mm256_min_ps(
+                _mm256_mul_ps(_mm256_and_ps(_mm256_sub_ps(boxX, vPosX), absMask), deltaDistX),
+                _mm256_mul_ps(_mm256_and_ps(_mm256_sub_ps(boxY, vPosY), absMask), deltaDistY)), _mm256_set1_ps(1e-3f));
+            
+            __m256 newX = _mm256_floor_ps(_mm256_add_ps(vPosX, _mm256_mul_ps(vDirX, exitT)));
+            __m256 newY = _mm256_floor_ps(_mm256_add_ps(vPosY, _mm256_mul_ps(vDirY, exitT)));
+            
+            __m256 newSideX = _mm256_mul_ps(_mm256_blendv_ps(_mm256_sub_ps(_mm256_add_ps(newX, one), vPosX), _mm256_sub_ps(vPosX, newX), negX), deltaDistX);
+            __m256 newSideY = _mm256_mul_ps(_mm256_blendv_ps(_mm256_sub_ps(_mm256_add_ps(newY, one), vPosY), _mm256_sub_ps(vPosY, newY), negY), deltaDistY);
+            
+            __m256 skipMask = _mm256_castsi256_ps(skip);
+            mapX = _mm256_blendv_epi8(mapX, _mm256_cvttps_epi32(newX), skip);
+            mapY = _mm256_blendv_epi8(mapY, _mm256_cvttps_epi32(newY), skip);
+            sideDistX = _mm256_blendv_ps(sideDistX, newSideX, skipMask);
+            sideDistY = _mm256_blendv_ps(sideDistY, newSideY, skipMask);
+        }
     }
-    else
+    
+    alignas(32) int outMapX[8];
+    alignas(32) int outMapY[8];
+    alignas(32) int outStepX[8];
+    alignas(32) int outStepY[8];
+    alignas(32) int outSide[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(outMapX), mapX);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(outMapY), mapY);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(outStepX), stepX);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(outStepY), stepY);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(outSide), side);
+    
+    for (int i = 0; i < 8; ++i)
+    {
+        finishRay(hits[i], posX, posY, rayDirX[i], rayDirY[i], outMapX[i], outMapY[i], outStepX[i], outStepY[i], outSide[i]);
+    }
+#else
+    // fallback - trace one at a time
+    for (int i = 0; i < 8; ++i)
+    {
+        hits[i] = castRay(rayDirX[i], rayDirY[i], player, map);
+    }
+#endif
+}
+
+
+void Raycaster::render(sf::RenderWindow& window, const Player& player, const Map& map, LightSystem& lightSystem)
+{
+    float ambientComponent = 0.08f;  // 8% base visibility
+    
+    if (m_cameraTableWidth != m_renderWidth || m_cameraTableFov != m_fov)
+    {
+        buildCameraTable();
+    }
+    
+    // temporal reuse - standing still is the common case, so only redo what the pose/battery invalidated
+    FrameKey key;
+    key.x = player.getX();
+    key.y = player.getY();
+    key.angle = player.getAngle();
+    key.flashlightOn = lightSystem.isFlashlightEnabled() && lightSystem.getFlashlightBattery() > 0.0f;
+    
+    // the low battery flicker needs a much finer bucket than the steady drain
+    float battery = lightSystem.getFlashlightBattery();
+    key.batteryBucket = battery >= 20.0f ? static_cast<int>(battery) : 1000 + static_cast<int>(battery * 10.0f);
+    key.mapRevision = map.getRevision();
+    key.lightRevision = lightSystem.getRevision();
+    
+    // a changed tile changes what the rays hit - nothing from before holds
+    if (key.mapRevision != m_lastKey.mapRevision)
+        invalidateHistory();
+    
+    bool moved = !m_traceValid || key.x != m_lastKey.x || key.y != m_lastKey.y;
+    bool poseChanged = moved || key.angle != m_lastKey.angle;
+    bool lightingChanged = poseChanged || !m_lightingValid || key.lightRevision != m_lastKey.lightRevision ||
+                           key.flashlightOn != m_lastKey.flashlightOn || key.batteryBucket != m_lastKey.batteryBucket;
+    
+    // switching the flashlight or any flicker has to show at once, not fade in through the history
+    if (key.flashlightOn != m_lastKey.flashlightOn || (key.batteryBucket != m_lastKey.batteryBucket && battery < 20.0f) ||
+        key.lightRevision != m_lastKey.lightRevision)
+        m_temporalValid = false;
+    
+    // PASS 1: trace (only when the camera moved) and light the columns.
+    // translation invalidates the angular cache, pure rotation resamples it
+    if (moved)
     {
-        stepX = 1;
-        sideDistX = (mapX + 1.0f - posX) * deltaDistX;
+        m_angularGeneration++;
+        
+        if (m_wallSpanTracing)
+            traceColumnSpans(player, map);
+        else
+            traceColumns(player, map);
+    }
+    else if (poseChanged)
+    {
+        traceColumnsFromCache(player, map);
     }
     
-    if (rayDirY < 0)
+    if (lightingChanged)
     {
-        stepY = -1;
-        sideDistY = (posY - mapY) * deltaDistY;
+        lightColumns(player, map, lightSystem, ambientComponent);
+    }
+    
+    m_lastKey = key;
+    m_traceValid = true;
+    m_lightingValid = !m_temporalPending;
+    
+    // PASS 2: smooth + emit, fused into one parallel stage per backend
+    bool outputStale = lightingChanged || !m_outputValid || m_outputBackend != m_renderBackend;
+    
+    if (m_renderBackend == RenderBackend::FRAMEBUFFER)
+    {
+        if (outputStale)
+            rasterizeFramebuffer(ambientComponent);
+        
+        window.draw(m_frameSprite);
     }
     else
     {
-        stepY = 1;
-        sideDistY = (mapY + 1.0f - posY) * deltaDistY;
+        if (outputStale)
+            emitVertices(ambientComponent);
+        
+        window.draw(m_floorCeiling);
+        window.draw(m_wallSlices);
     }
     
-    bool hitWall = false;
-    int side = 0;  // 0 = vertical, 1 = horizontal
+    m_outputValid = true;
+    m_outputBackend = m_renderBackend;
+}
+
+void Raycaster::traceColumns(const Player& player, const Map& map)
+{
+    const int packetCount = (m_renderWidth + 7) / 8;
+    float viewDirX = player.getDirX();
+    float viewDirY = player.getDirY();
     
-    while (!hitWall && hit.distance > 0.1f)
+    // 8 columns per packet
+    #pragma omp parallel for schedule(dynamic, 8)
+    for (int packet = 0; packet < packetCount; ++packet)
     {
-        if (sideDistX < sideDistY)
+        int firstColumn = packet * 8;
+        int lanes = std::min(8, m_renderWidth - firstColumn);
+        
+        alignas(32) float rayDirX[8];
+        alignas(32) float rayDirY[8];
+        RayHit hits[8];
+        
+        // rotate the camera table by the view direction - no trig per column
+        for (int lane = 0; lane < 8; ++lane)
         {
-            sideDistX += deltaDistX;
-            mapX += stepX;
-            side = 0;
+            float camCos = m_cameraCos[firstColumn + lane];
+            float camSin = m_cameraSin[firstColumn + lane];
+            rayDirX[lane] = camCos * viewDirX - camSin * viewDirY;
+            rayDirY[lane] = camSin * viewDirX + camCos * viewDirY;
         }
-        else
+        
+        castRayPacket(rayDirX, rayDirY, player, map, hits);
+        
+        for (int lane = 0; lane < lanes; ++lane)
+        {
+            storeColumn(firstColumn + lane, hits[lane], rayDirX[lane], rayDirY[lane]);
+        }
+    }
+}
+
+void Raycaster::traceColumnsFromCache(const Player& player, const Map& map)
+{
+    const float binsPerRadian = static_cast<float>(ANGULAR_BINS) / MathUtils::TWO_PI;
+    
+    float baseAngle = std::fmod(player.getAngle(), MathUtils::TWO_PI);
+    if (baseAngle < 0.0f)
+        baseAngle += MathUtils::TWO_PI;
+    
+    auto wrapBin = [](int bin) { return ((bin % ANGULAR_BINS) + ANGULAR_BINS) % ANGULAR_BINS; };
+    
+    // every column interpolates between two bins, so make sure the whole arc is filled (it may wrap)
+    int firstBin = static_cast<int>(std::floor((baseAngle + m_cameraAngle[0]) * binsPerRadian));
+    int lastBin = static_cast<int>(std::floor((baseAngle + m_cameraAngle[m_renderWidth - 1]) * binsPerRadian)) + 1;
+    
+    m_missingBins.clear();
+    for (int b = firstBin; b <= lastBin; ++b)
+    {
+        int bin = wrapBin(b);
+        if (m_angularStamp[bin] != m_angularGeneration)
+            m_missingBins.push_back(bin);
+    }
+    
+    const int missingCount = static_cast<int>(m_missingBins.size());
+    const int packetCount = (missingCount + 7) / 8;
+    
+    #pragma omp parallel for schedule(dynamic, 8)
+    for (int packet = 0; packet < packetCount; ++packet)
+    {
+        int first = packet * 8;
+        int lanes = std::min(8, missingCount - first);
+        
+        alignas(32) float rayDirX[8];
+        alignas(32) float rayDirY[8];
+        RayHit hits[8];
+        
+        for (int lane = 0; lane < 8; ++lane)
         {
-            sideDistY += deltaDistY;
-            mapY += stepY;
-            side = 1;
+            int bin = m_missingBins[first + std::min(lane, lanes - 1)];
+            rayDirX[lane] = m_binDirX[bin];
+            rayDirY[lane] = m_binDirY[bin];
         }
         
-        if (map.isWall(mapX, mapY))
+        castRayPacket(rayDirX, rayDirY, player, map, hits);
+        
+        for (int lane = 0; lane < lanes; ++lane)
         {
-            hitWall = true;
+            int bin = m_missingBins[first + lane];
+            m_angularHits[bin] = hits[lane];
+            m_angularStamp[bin] = m_angularGeneration;
         }
     }
     
-    if (side == 0)
+    float posX = player.getX();
+    float posY = player.getY();
+    float viewDirX = player.getDirX();
+    float viewDirY = player.getDirY();
+    
+    #pragma omp parallel for schedule(static)
+    for (int x = 0; x < m_renderWidth; ++x)
     {
-        hit.distance = (mapX - posX + (1 - stepX) / 2) / rayDirX;
-        hit.hitVertical = true;
-        hit.hitX = posX + hit.distance * rayDirX;
-        hit.hitY = posY + hit.distance * rayDirY;
+        float rayDirX = m_cameraCos[x] * viewDirX - m_cameraSin[x] * viewDirY;
+        float rayDirY = m_cameraSin[x] * viewDirX + m_cameraCos[x] * viewDirY;
+        
+        int bin = static_cast<int>(std::floor((baseAngle + m_cameraAngle[x]) * binsPerRadian));
+        const RayHit& left = m_angularHits[wrapBin(bin)];
+        const RayHit& right = m_angularHits[wrapBin(bin + 1)];
+        
+        RayHit hit;
+        
+        if (sameFace(left, right))
+        {
+            // both neighbours see the same wall face - intersect it directly, same math as the DDA exit
+            int stepX = rayDirX < 0 ? -1 : 1;
+            int stepY = rayDirY < 0 ? -1 : 1;
+            finishRay(hit, posX, posY, rayDirX, rayDirY, left.mapX, left.mapY, stepX, stepY, left.hitVertical ? 0 : 1);
+        }
+        else
+        {
+            // face edge falls between the bins - trace this column for real
+            hit = castRay(rayDirX, rayDirY, player, map);
+        }
+        
+        storeColumn(x, hit, rayDirX, rayDirY);
     }
-    else
+}
+
+void Raycaster::traceColumnSpans(const Player& player, const Map& map)
+{
+    float posX = player.getX();
+    float posY = player.getY();
+    float viewDirX = player.getDirX();
+    float viewDirY = player.getDirY();
+    
+    auto columnDir = [&](int x, float& rayDirX, float& rayDirY)
     {
-        hit.distance = (mapY - posY + (1 - stepY) / 2) / rayDirY;
-        hit.hitVertical = false;
-        hit.hitX = posX + hit.distance * rayDirX;
-        hit.hitY = posY + hit.distance * rayDirY;
+        rayDirX = m_cameraCos[x] * viewDirX - m_cameraSin[x] * viewDirY;
+        rayDirY = m_cameraSin[x] * viewDirX + m_cameraCos[x] * viewDirY;
+    };
+    
+    // anchors: every SPAN_STRIDE-th column plus the last one. nothing narrower than
+    // the stride can hide between two anchors that see the same face
+    m_spanAnchors.clear();
+    for (int x = 0; x < m_renderWidth; x += SPAN_STRIDE)
+        m_spanAnchors.push_back(x);
+    if (m_spanAnchors.back() != m_renderWidth - 1)
+        m_spanAnchors.push_back(m_renderWidth - 1);
+    
+    const int anchorCount = static_cast<int>(m_spanAnchors.size());
+    const int packetCount = (anchorCount + 7) / 8;
+    
+    #pragma omp parallel for schedule(dynamic, 4)
+    for (int packet = 0; packet < packetCount; ++packet)
+    {
+        int first = packet * 8;
+        int lanes = std::min(8, anchorCount - first);
+        
+        alignas(32) float rayDirX[8];
+        alignas(32) float rayDirY[8];
+        RayHit hits[8];
+        
+        for (int lane = 0; lane < 8; ++lane)
+            columnDir(m_spanAnchors[first + std::min(lane, lanes - 1)], rayDirX[lane], rayDirY[lane]);
+        
+        castRayPacket(rayDirX, rayDirY, player, map, hits);
+        
+        for (int lane = 0; lane < lanes; ++lane)
+            m_columnHits[m_spanAnchors[first + lane]] = hits[lane];
     }
     
-    hit.mapX = mapX;
-    hit.mapY = mapY;
+    // subdivide between anchors until both ends of every interval see the same face,
+    // then fill the inside analytically
+    #pragma omp parallel for schedule(dynamic, 8)
+    for (int i = 0; i < anchorCount - 1; ++i)
+    {
+        int stack[2 * SPAN_STRIDE];
+        int top = 0;
+        stack[top++] = m_spanAnchors[i];
+        stack[top++] = m_spanAnchors[i + 1];
+        
+        while (top > 0)
+        {
+            int right = stack[--top];
+            int left = stack[--top];
+            
+            if (right - left < 2)
+                continue;
+            
+            const RayHit& leftHit = m_columnHits[left];
+            const RayHit& rightHit = m_columnHits[right];
+            
+            if (sameFace(leftHit, rightHit))
+            {
+                for (int x = left + 1; x < right; ++x)
+                {
+                    float rayDirX, rayDirY;
+                    columnDir(x, rayDirX, rayDirY);
+                    
+                    int stepX = rayDirX < 0 ? -1 : 1;
+                    int stepY = rayDirY < 0 ? -1 : 1;
+                    finishRay(m_columnHits[x], posX, posY, rayDirX, rayDirY,
+                              leftHit.mapX, leftHit.mapY, stepX, stepY, leftHit.hitVertical ? 0 : 1);
+                }
+                continue;
+            }
+            
+            int mid = (left + right) / 2;
+            float rayDirX, rayDirY;
+            columnDir(mid, rayDirX, rayDirY);
+            m_columnHits[mid] = castRay(rayDirX, rayDirY, player, map);
+            
+            stack[top++] = left;
+            stack[top++] = mid;
+            stack[top++] = mid;
+            stack[top++] = right;
+        }
+    }
     
-    return hit;
+    #pragma omp parallel for schedule(static)
+    for (int x = 0; x < m_renderWidth; ++x)
+    {
+        float rayDirX, rayDirY;
+        columnDir(x, rayDirX, rayDirY);
+        storeColumn(x, m_columnHits[x], rayDirX, rayDirY);
+    }
 }
 
+void Raycaster::storeColumn(int x, const RayHit& hit, float rayDirX, float rayDirY)
+{
+    // fish-eye fix
+    float correctedDistance = hit.distance * m_cameraCos[x];
+    
+    if (correctedDistance < 0.1f)
+        correctedDistance = 0.1f;
+    
+    int wallHeight = static_cast<int>(m_screenHeight / correctedDistance);
+    
+    if (wallHeight > m_screenHeight * 10)
+        wallHeight = m_screenHeight * 10;
+    
+    int drawStart = (m_screenHeight - wallHeight) / 2;
+    int drawEnd = drawStart + wallHeight;
+    
+    m_columnDepth[x] = correctedDistance;
+    
+    RayData& data = m_rayDataBuffer[x];
+    data.correctedDistance = correctedDistance;
+    data.drawStart = drawStart;
+    data.drawEnd = drawEnd;
+    data.hitVertical = hit.hitVertical;
+    data.mapX = hit.mapX;
+    data.mapY = hit.mapY;
+    data.rayDirX = rayDirX;
+    data.rayDirY = rayDirY;
+    data.hitX = hit.hitX;
+    data.hitY = hit.hitY;
+}
 
-void Raycaster::render(sf::RenderWindow& window, const Player& player, const Map& map, const LightSystem& lightSystem)
+int Raycaster::lightSampleCount(float correctedDistance) const
 {
-    m_floorCeiling.clear();
-    m_wallSlices.clear();
+    switch (m_lightingQuality)
+    {
+        case LightingQuality::LOW:
+            return 2;
+        case LightingQuality::MEDIUM:
+            return 3;
+        case LightingQuality::HIGH:
+        default:
+            return correctedDistance < 4.0f ? 5 : 3;
+    }
+}
+
+int Raycaster::lightingStride() const
+{
+    switch (m_lightingQuality)
+    {
+        case LightingQuality::LOW:
+            return 8;
+        case LightingQuality::MEDIUM:
+            return 4;
+        case LightingQuality::HIGH:
+        default:
+            return 1;
+    }
+}
+
+bool Raycaster::lightingContinuous(int x) const
+{
+    const RayData& left = m_rayDataBuffer[x - 1];
+    const RayData& right = m_rayDataBuffer[x];
+    
+    if (left.hitVertical != right.hitVertical)
+        return false;
+    
+    // one wall plane: the tile across the face stays, the one along it moves by at most one
+    bool samePlane = left.hitVertical ? (left.mapX == right.mapX && std::abs(left.mapY - right.mapY) <= 1)
+                                      : (left.mapY == right.mapY && std::abs(left.mapX - right.mapX) <= 1);
+    
+    float depthStep = std::abs(left.correctedDistance - right.correctedDistance);
+    return samePlane && depthStep < LOD_DEPTH_TOLERANCE * std::min(left.correctedDistance, right.correctedDistance);
+}
+
+void Raycaster::reprojectHistory(const Player& player)
+{
+    bool colored = m_lightingQuality != LightingQuality::LOW;
+    
+    if (!m_temporalValid || m_historyWidth != m_renderWidth || m_historyChannels != (colored ? 3 : 1))
+    {
+        std::fill(m_historyColumn.begin(), m_historyColumn.begin() + m_renderWidth, -1);
+        return;
+    }
+    
+    // a turn or a jump this big changes the flashlight too much for the old lighting to help.
+    // an unchanged pose relights in full instead, so a resting camera always settles on the exact result
+    float moveX = player.getX() - m_historyX;
+    float moveY = player.getY() - m_historyY;
+    bool resting = moveX == 0.0f && moveY == 0.0f && player.getDirX() == m_historyDirX && player.getDirY() == m_historyDirY;
     
+    if (resting || player.getDirX() * m_historyDirX + player.getDirY() * m_historyDirY < std::cos(TEMPORAL_MAX_TURN) ||
+        moveX * moveX + moveY * moveY > TEMPORAL_MAX_MOVE * TEMPORAL_MAX_MOVE)
+    {
+        std::fill(m_historyColumn.begin(), m_historyColumn.begin() + m_renderWidth, -1);
+        return;
+    }
+    
+    const float tanHalfFov = std::tan(m_fov / 2.0f);
+    
+    // project each column's wall point into last frame's camera, same mapping as the columns
+    for (int x = 0; x < m_renderWidth; ++x)
+    {
+        const RayData& data = m_rayDataBuffer[x];
+        m_historyColumn[x] = -1;
+        
+        float dx = data.hitX - m_historyX;
+        float dy = data.hitY - m_historyY;
+        float forward = dx * m_historyDirX + dy * m_historyDirY;
+        
+        if (forward <= 0.1f)
+            continue;
+        
+        float lateral = dy * m_historyDirX - dx * m_historyDirY;
+        float cameraX = lateral / (forward * tanHalfFov);
+        int column = static_cast<int>(std::floor((cameraX + 1.0f) * 0.5f * m_renderWidth + 0.5f));
+        
+        if (column < 0 || column >= m_renderWidth)
+            continue;
+        
+        // last frame saw something else there - a nearer wall, or another face of this one
+        if (std::abs(m_historyDepth[column] - forward) > TEMPORAL_DEPTH_TOLERANCE * forward ||
+            (m_historyVertical[column] != 0) != data.hitVertical)
+        {
+            continue;
+        }
+        
+        m_historyColumn[x] = column;
+    }
+}
+
+void Raycaster::lightColumns(const Player& player, const Map& map, LightSystem& lightSystem, float ambientComponent)
+{
     float fogDistance = lightSystem.isFlashlightEnabled() && lightSystem.getFlashlightBattery() > 0.0f ? 6.0f : 2.5f;
-    float ambientComponent = 0.08f;  // 8% base visibility
     
-    // PASS 1: calculate all ray data and lighting values (parallel)
-    #pragma omp parallel for schedule(dynamic, 64)
-    for (int x = 0; x < m_screenWidth; ++x)
+    // the columns were traced from the flashlight's origin, so their depths are its shadow map
+    lightSystem.setFlashlightShadowMap(m_columnDepth.data(), m_renderWidth, player.getDirX(), player.getDirY(),
+                                       std::tan(m_fov / 2.0f));
+    
+    // light every Nth column plus both columns at every break in the wall surface, so
+    // whatever is skipped sits between two lit columns on the same continuous surface
+    const int stride = lightingStride();
+    int litCount = 0;
+    
+    for (int x = 0; x < m_renderWidth; ++x)
+    {
+        bool lit = x % stride == 0 || x == m_renderWidth - 1 || !lightingContinuous(x) ||
+                   (x + 1 < m_renderWidth && !lightingContinuous(x + 1));
+        
+        if (lit)
+            m_litColumns[litCount++] = x;
+        
+        m_litBefore[x] = litCount - 1;
+    }
+    
+    reprojectHistory(player);
+    
+    // columns with history keep the sample at the player (shared by every column, so free) and
+    // take only TEMPORAL_SAMPLES of their other positions, spread out and rotating per frame and
+    // per column. every position comes up equally often, so the history converges to the full set
+    m_temporalFrame = (m_temporalFrame + 1) % 1024;
+    const int phase = static_cast<int>(m_temporalFrame);
+    m_temporalPending = false;
+    
+    for (int i = 0; i < litCount; ++i)
     {
-        float cameraX = 2.0f * x / static_cast<float>(m_screenWidth) - 1.0f;
-        float rayAngle = player.getAngle() + std::atan(cameraX * std::tan(m_fov / 2.0f));
+        int x = m_litColumns[i];
+        int fullSamples = lightSampleCount(m_rayDataBuffer[x].correctedDistance);
         
-        RayHit hit = castRay(rayAngle, player, map);
+        if (m_historyColumn[x] >= 0)
+        {
+            m_columnSamples[x] = 1 + std::min(TEMPORAL_SAMPLES, fullSamples - 1);
+            m_temporalPending = true;
+        }
+        else
+        {
+            m_columnSamples[x] = fullSamples;
+        }
+    }
+    
+    // position of a column's volumetric sample among the full set (0 = at the player)
+    auto samplePosition = [&](int x, int slot) -> int
+    {
+        if (m_historyColumn[x] < 0 || slot == 0)
+            return slot;
+        
+        int others = lightSampleCount(m_rayDataBuffer[x].correctedDistance) - 1;
+        int taken = m_columnSamples[x] - 1;
+        return 1 + (phase + x + (slot - 1) * others / taken) % others;
+    };
+    
+    auto sampleDistance = [&](int x, int slot, float maxSampleDist) -> float
+    {
+        int fullSamples = lightSampleCount(m_rayDataBuffer[x].correctedDistance);
+        return (static_cast<float>(samplePosition(x, slot)) / static_cast<float>(fullSamples - 1)) * maxSampleDist;
+    };
+    
+    // gather every lighting sample of the frame (volumetric ones along the ray, then the wall hit).
+    // sample-major order keeps neighbouring entries from neighbouring columns, close in space
+    const int slotsPerColumn = MAX_LIGHT_SAMPLES + 1;
+    const float playerX = player.getX();
+    const float playerY = player.getY();
+    int sampleCount = 0;
+    
+    // every column's first volumetric sample is the player's own position - light it once
+    const int originSample = sampleCount++;
+    m_sampleX[originSample] = playerX;
+    m_sampleY[originSample] = playerY;
+    
+    // the near cache follows the player in whole nodes, so nodes stay fixed points in the world
+    m_nearOriginX = static_cast<int>(std::floor(playerX * NEAR_CACHE_RESOLUTION)) - NEAR_CACHE_RADIUS * NEAR_CACHE_RESOLUTION;
+    m_nearOriginY = static_cast<int>(std::floor(playerY * NEAR_CACHE_RESOLUTION)) - NEAR_CACHE_RADIUS * NEAR_CACHE_RESOLUTION;
+    std::fill(m_nearNodeSample.begin(), m_nearNodeSample.end(), NODE_UNCHECKED);
+    int nearCount = 0;
+    
+    const float tanHalfFov = std::tan(m_fov / 2.0f);
+    
+    // a node may stand in for the samples around it only if it sits in front of the depth
+    // buffer - otherwise a wall or a corner between it and the player would leak into the blend
+    auto nodeInView = [&](int nodeX, int nodeY) -> bool
+    {
+        float dx = static_cast<float>(m_nearOriginX + nodeX) / NEAR_CACHE_RESOLUTION - playerX;
+        float dy = static_cast<float>(m_nearOriginY + nodeY) / NEAR_CACHE_RESOLUTION - playerY;
         
-        // fish-eye fix
-        float angleDiff = rayAngle - player.getAngle();
+        float forward = dx * player.getDirX() + dy * player.getDirY();
+        if (forward <= 0.0f)
+            return false;
         
-        while (angleDiff > PI) angleDiff -= 2.0f * PI;
-        while (angleDiff < -PI) angleDiff += 2.0f * PI;
+        float lateral = dy * player.getDirX() - dx * player.getDirY();
+        float cameraX = lateral / (forward * tanHalfFov);
+        int column = static_cast<int>(std::floor((cameraX + 1.0f) * 0.5f * m_renderWidth + 0.5f));
         
-        float correctedDistance = hit.distance * std::cos(angleDiff);
+        const float wallMargin = 0.25f;
+        return column >= 0 && column < m_renderWidth && forward < m_columnDepth[column] - wallMargin;
+    };
+    
+    // m_sampleSlot entry of a volumetric sample served by the near cache, or 0 if it can't be
+    auto nearCacheEntry = [&](float sampleX, float sampleY) -> int
+    {
+        float dx = sampleX - playerX;
+        float dy = sampleY - playerY;
         
-        if (correctedDistance < 0.1f)
-            correctedDistance = 0.1f;
+        if (dx * dx + dy * dy < NEAR_CACHE_MIN_DISTANCE * NEAR_CACHE_MIN_DISTANCE)
+            return 0;
         
-        int wallHeight = static_cast<int>(m_screenHeight / correctedDistance);
+        float u = sampleX * NEAR_CACHE_RESOLUTION - m_nearOriginX;
+        float v = sampleY * NEAR_CACHE_RESOLUTION - m_nearOriginY;
+        int nodeX = static_cast<int>(std::floor(u));
+        int nodeY = static_cast<int>(std::floor(v));
         
-        if (wallHeight > m_screenHeight * 10)
-            wallHeight = m_screenHeight * 10;
+        if (nodeX < 0 || nodeY < 0 || nodeX + 1 >= NEAR_CACHE_SIZE || nodeY + 1 >= NEAR_CACHE_SIZE)
+            return 0;
         
-        int drawStart = (m_screenHeight - wallHeight) / 2;
-        int drawEnd = drawStart + wallHeight;
+        int node = nodeY * NEAR_CACHE_SIZE + nodeX;
         
-        int samples;
+        for (int corner = 0; corner < 4; ++corner)
+        {
+            int& state = m_nearNodeSample[node + (corner >> 1) * NEAR_CACHE_SIZE + (corner & 1)];
+            
+            if (state == NODE_UNCHECKED)
+                state = nodeInView(nodeX + (corner & 1), nodeY + (corner >> 1)) ? NODE_UNUSED : NODE_HIDDEN;
+            
+            if (state == NODE_HIDDEN)
+                return 0;
+        }
         
-        switch (m_lightingQuality)
+        for (int corner = 0; corner < 4; ++corner)
         {
-            case LightingQuality::LOW:
-                samples = 2;
-                break;
-            case LightingQuality::MEDIUM:
-                samples = 3;
-                break;
-            case LightingQuality::HIGH:
-            default:
-                samples = correctedDistance < 4.0f ? 5 : 3;
-                break;
+            int cornerNode = node + (corner >> 1) * NEAR_CACHE_SIZE + (corner & 1);
+            
+            if (m_nearNodeSample[cornerNode] == NODE_UNUSED)
+            {
+                m_sampleX[sampleCount] = static_cast<float>(m_nearOriginX + nodeX + (corner & 1)) / NEAR_CACHE_RESOLUTION;
+                m_sampleY[sampleCount] = static_cast<float>(m_nearOriginY + nodeY + (corner >> 1)) / NEAR_CACHE_RESOLUTION;
+                m_nearNodeSample[cornerNode] = sampleCount++;
+            }
         }
         
-        float avgLighting;
+        NearSample& near = m_nearSamples[nearCount];
+        near.node = node;
+        near.fx = u - nodeX;
+        near.fy = v - nodeY;
         
+        return -1 - nearCount++;
+    };
+    
+    for (int slot = 0; slot < slotsPerColumn; ++slot)
+    {
+        for (int i = 0; i < litCount; ++i)
         {
-            float totalLighting = 0.0f;
+            int x = m_litColumns[i];
+            const RayData& data = m_rayDataBuffer[x];
+            int samples = m_columnSamples[x];
+            int& entry = m_sampleSlot[x * slotsPerColumn + slot];
             
-            float rayDirX = std::cos(rayAngle);
-            float rayDirY = std::sin(rayAngle);
+            if (slot > samples)
+                continue;
+            
+            if (slot == 0)
+            {
+                entry = originSample;
+                continue;
+            }
+            
+            if (slot == samples)
+            {
+                m_sampleX[sampleCount] = data.hitX;
+                m_sampleY[sampleCount] = data.hitY;
+            }
+            else
+            {
+                float t = sampleDistance(x, slot, std::min(data.correctedDistance, 15.0f));
+                float sampleX = playerX + data.rayDirX * t;
+                float sampleY = playerY + data.rayDirY * t;
+                
+                entry = nearCacheEntry(sampleX, sampleY);
+                if (entry < 0)
+                    continue;
+                
+                m_sampleX[sampleCount] = sampleX;
+                m_sampleY[sampleCount] = sampleY;
+            }
+            
+            entry = sampleCount++;
+        }
+    }
+    
+    // LOW stays gray - one channel instead of three
+    bool colored = m_lightingQuality != LightingQuality::LOW;
+    int channelCount = colored ? 3 : 1;
+    
+    if (colored)
+    {
+        lightSystem.calculateLightingBatchRGB(m_sampleX.data(), m_sampleY.data(), m_sampleLight[0].data(),
+                                              m_sampleLight[1].data(), m_sampleLight[2].data(), sampleCount, player, map);
+    }
+    else
+    {
+        lightSystem.calculateLightingBatch(m_sampleX.data(), m_sampleY.data(), m_sampleLight[0].data(), sampleCount, player, map);
+    }
+    
+    lightSystem.clearFlashlightShadowMap();
+    
+    #pragma omp parallel for schedule(static)
+    for (int lit = 0; lit < litCount; ++lit)
+    {
+        int x = m_litColumns[lit];
+        float correctedDistance = m_rayDataBuffer[x].correctedDistance;
+        const int* slots = &m_sampleSlot[x * slotsPerColumn];
+        
+        int samples = m_columnSamples[x];
+        int fullSamples = lightSampleCount(correctedDistance);
+        
+        // a partial set stands in for all the positions past the player
+        float partialWeight = samples == fullSamples ? 1.0f : static_cast<float>(fullSamples - 1) / static_cast<float>(samples - 1);
+        
+        for (int c = 0; c < channelCount; ++c)
+        {
+            float totalLighting = 0.0f;
             
             float maxSampleDist = std::min(correctedDistance, 15.0f);
             
             for (int i = 0; i < samples; ++i)
             {
-                float t = (static_cast<float>(i) / static_cast<float>(samples - 1)) * maxSampleDist;
-                float sampleX = player.getX() + rayDirX * t;
-                float sampleY = player.getY() + rayDirY * t;
-                
-                float lighting = lightSystem.calculateLighting(sampleX, sampleY, player, map);
+                float t = sampleDistance(x, i, maxSampleDist);
+                float lighting = sampleLighting(c, slots[i]);
                 
                 float fogFactor = 1.0f - (t / maxSampleDist);
                 fogFactor = fogFactor * fogFactor;
                 
-                totalLighting += lighting * (0.5f + 0.5f * fogFactor);
+                totalLighting += lighting * (0.5f + 0.5f * fogFactor) * (i == 0 ? 1.0f : partialWeight);
             }
             
-            avgLighting = totalLighting / static_cast<float>(samples);
+            float avg = totalLighting / static_cast<float>(fullSamples);
+            
+            float wallLighting = m_sampleLight[c][slots[samples]];
+            m_columnLight[c][x] = avg * 0.6f + wallLighting * 0.4f;
+        }
+    }
+    
+    // this frame's lighting of any column - skipped columns blend the lit ones on either side
+    auto freshLighting = [&](int c, int x) -> float
+    {
+        const std::vector<float>& columnLight = m_columnLight[c];
+        int before = m_litBefore[x];
+        int left = m_litColumns[before];
+        
+        if (left == x)
+            return columnLight[x];
+        
+        int right = m_litColumns[before + 1];
+        float blend = static_cast<float>(x - left) / static_cast<float>(right - left);
+        return MathUtils::lerp(columnLight[left], columnLight[right], blend);
+    };
+    
+    #pragma omp parallel for schedule(static)
+    for (int x = 0; x < m_renderWidth; ++x)
+    {
+        RayData& data = m_rayDataBuffer[x];
+        float correctedDistance = data.correctedDistance;
+        
+        float channelLighting[3];
+        int previous = m_historyColumn[x];
+        
+        for (int c = 0; c < channelCount; ++c)
+        {
+            channelLighting[c] = freshLighting(c, x);
+            
+            if (previous >= 0)
+                channelLighting[c] = MathUtils::lerp(m_historyLight[c][previous], channelLighting[c], TEMPORAL_BLEND);
+            
+            m_nextHistoryLight[c][x] = channelLighting[c];
+        }
+        
+        // brightness from the strongest channel, color as a tint on top of it
+        float avgLighting = channelLighting[0];
+        data.tintR = data.tintG = data.tintB = 1.0f;
+        
+        if (colored)
+        {
+            avgLighting = std::max(channelLighting[0], std::max(channelLighting[1], channelLighting[2]));
             
-            float wallLighting = lightSystem.calculateLighting(hit.hitX, hit.hitY, player, map);
-            avgLighting = avgLighting * 0.6f + wallLighting * 0.4f;
+            if (avgLighting > 0.0f)
+            {
+                data.tintR = channelLighting[0] / avgLighting;
+                data.tintG = channelLighting[1] / avgLighting;
+                data.tintB = channelLighting[2] / avgLighting;
+            }
         }
         
         float distanceFog = 1.0f;
@@ -215,98 +1147,219 @@ void Raycaster::render(sf::RenderWindow& window, const Player& player, const Map
         float foggedAmbient = ambientComponent * distanceFog;
         float finalLighting = lightSourceComponent + foggedAmbient;
         
-        float sideFactor = hit.hitVertical ? 1.0f : 0.94f;
+        float sideFactor = data.hitVertical ? 1.0f : 0.94f;
         float wallBrightness = finalLighting * sideFactor;
         
-        m_rayDataBuffer[x].correctedDistance = correctedDistance;
-        m_rayDataBuffer[x].drawStart = drawStart;
-        m_rayDataBuffer[x].drawEnd = drawEnd;
-        m_rayDataBuffer[x].hitVertical = hit.hitVertical;
-        m_rayDataBuffer[x].rawLighting = avgLighting;
-        m_rayDataBuffer[x].distanceFog = distanceFog;
+        data.rawLighting = avgLighting;
+        data.distanceFog = distanceFog;
         m_lightingBuffer[x] = wallBrightness;
+        
+        m_historyDepth[x] = correctedDistance;
+        m_historyVertical[x] = data.hitVertical ? 1 : 0;
     }
     
-    // smooth the lighting buffer - 5-tap weighted filter
-    for (int x = 0; x < m_screenWidth; ++x)
+    // this frame becomes the history of the next one
+    for (int c = 0; c < channelCount; ++c)
+        m_historyLight[c].swap(m_nextHistoryLight[c]);
+    
+    m_temporalValid = true;
+    m_historyWidth = m_renderWidth;
+    m_historyChannels = channelCount;
+    m_historyX = playerX;
+    m_historyY = playerY;
+    m_historyDirX = player.getDirX();
+    m_historyDirY = player.getDirY();
+}
+
+float Raycaster::sampleLighting(int channel, int entry) const
+{
+    const std::vector<float>& sampleLight = m_sampleLight[channel];
+    
+    if (entry >= 0)
+        return sampleLight[entry];
+    
+    // bilinear between the four near cache nodes around the sample
+    const NearSample& near = m_nearSamples[-1 - entry];
+    const int* node = &m_nearNodeSample[near.node];
+    
+    float top = MathUtils::lerp(sampleLight[node[0]], sampleLight[node[1]], near.fx);
+    float bottom = MathUtils::lerp(sampleLight[node[NEAR_CACHE_SIZE]], sampleLight[node[NEAR_CACHE_SIZE + 1]], near.fx);
+    
+    return MathUtils::lerp(top, bottom, near.fy);
+}
+
+// 5-tap weighted filter over the pass 1 lighting, so it can run per column in parallel
+float Raycaster::smoothLighting(int x) const
+{
+    float sum = m_lightingBuffer[x] * 2.0f;
+    float weight = 2.0f;
+    
+    if (x > 0)
     {
-        float sum = m_lightingBuffer[x] * 2.0f;
-        float weight = 2.0f;
-        
-        if (x > 0)
-        {
-            sum += m_lightingBuffer[x - 1];
-            weight += 1.0f;
-        }
-        if (x > 1)
-        {
-            sum += m_lightingBuffer[x - 2] * 0.5f;
-            weight += 0.5f;
-        }
-        if (x < m_screenWidth - 1)
-        {
-            sum += m_lightingBuffer[x + 1];
-            weight += 1.0f;
-        }
-        if (x < m_screenWidth - 2)
-        {
-            sum += m_lightingBuffer[x + 2] * 0.5f;
-            weight += 0.5f;
-        }
-        
-        m_smoothedBuffer[x] = sum / weight;
+        sum += m_lightingBuffer[x - 1];
+        weight += 1.0f;
+    }
+    if (x > 1)
+    {
+        sum += m_lightingBuffer[x - 2] * 0.5f;
+        weight += 0.5f;
+    }
+    if (x < m_renderWidth - 1)
+    {
+        sum += m_lightingBuffer[x + 1];
+        weight += 1.0f;
     }
+    if (x < m_renderWidth - 2)
+    {
+        sum += m_lightingBuffer[x + 2] * 0.5f;
+        weight += 0.5f;
+    }
+    
+    return sum / weight;
+}
+
+void Raycaster::shadeColumn(int x, float ambientComponent, sf::Color& wallColor, sf::Color& ceilingColor, sf::Color& floorColor) const
+{
+    const RayData& data = m_rayDataBuffer[x];
+    float wallBrightness = smoothLighting(x);
+    
+    // tint is 1 on the gray path, so this is exact there
+    auto tinted = [&data](float value)
+    {
+        return sf::Color(static_cast<sf::Uint8>(value * data.tintR),
+                         static_cast<sf::Uint8>(value * data.tintG),
+                         static_cast<sf::Uint8>(value * data.tintB));
+    };
+    
+    int colorValue = static_cast<int>(wallBrightness * 255.0f);
+    colorValue = std::max(0, std::min(255, colorValue));
+    wallColor = tinted(static_cast<float>(colorValue));
+    
+    float lightSource = std::max(0.0f, data.rawLighting - ambientComponent);
+    float foggedAmbient = ambientComponent * data.distanceFog;
+    float finalLight = lightSource + foggedAmbient;
     
-    // PASS 2: render using smoothed lighting
-    for (int x = 0; x < m_screenWidth; ++x)
+    int ceilingValue = static_cast<int>(finalLight * 20.0f);
+    ceilingValue = std::max(0, std::min(255, ceilingValue));
+    ceilingColor = tinted(static_cast<float>(ceilingValue));
+    
+    int floorValue = static_cast<int>(finalLight * 30.0f);
+    floorValue = std::max(0, std::min(255, floorValue));
+    floorColor = tinted(static_cast<float>(floorValue));
+}
+
+void Raycaster::emitVertices(float ambientComponent)
+{
+    float columnScale = static_cast<float>(m_outputWidth) / static_cast<float>(m_renderWidth);
+    float bottom = static_cast<float>(m_screenHeight);
+    
+    // fixed layout: 4 wall + 8 floor/ceiling vertices per column, so every column
+    // writes its own slots and no thread ever appends
+    m_wallSlices.resize(m_renderWidth * 4);
+    m_floorCeiling.resize(m_renderWidth * 8);
+    
+    #pragma omp parallel for schedule(static)
+    for (int x = 0; x < m_renderWidth; ++x)
     {
         const RayData& data = m_rayDataBuffer[x];
-        float wallBrightness = m_smoothedBuffer[x];
         
-        int colorValue = static_cast<int>(wallBrightness * 255.0f);
-        colorValue = std::max(0, std::min(255, colorValue));
-        sf::Color wallColor(colorValue, colorValue, colorValue);
+        sf::Color wallColor, ceilingColor, floorColor;
+        shadeColumn(x, ambientComponent, wallColor, ceilingColor, floorColor);
         
-        float xPos = static_cast<float>(x);
+        // upscale - each column covers columnScale window pixels
+        float xPos = static_cast<float>(x) * columnScale;
+        float xEnd = static_cast<float>(x + 1) * columnScale;
         float yStart = static_cast<float>(data.drawStart);
         float yEnd = static_cast<float>(data.drawEnd);
         
-        m_wallSlices.append(sf::Vertex(sf::Vector2f(xPos, yStart), wallColor));
-        m_wallSlices.append(sf::Vertex(sf::Vector2f(xPos + 1.0f, yStart), wallColor));
-        m_wallSlices.append(sf::Vertex(sf::Vector2f(xPos + 1.0f, yEnd), wallColor));
-        m_wallSlices.append(sf::Vertex(sf::Vector2f(xPos, yEnd), wallColor));
+        sf::Vertex* wall = &m_wallSlices[x * 4];
+        wall[0] = sf::Vertex(sf::Vector2f(xPos, yStart), wallColor);
+        wall[1] = sf::Vertex(sf::Vector2f(xEnd, yStart), wallColor);
+        wall[2] = sf::Vertex(sf::Vector2f(xEnd, yEnd), wallColor);
+        wall[3] = sf::Vertex(sf::Vector2f(xPos, yEnd), wallColor);
+        
+        // ceiling/floor collapse to zero height when the wall covers the whole column
+        float ceilingEnd = std::max(0.0f, yStart);
+        float floorStart = std::min(bottom, yEnd);
+        
+        sf::Vertex* floorCeiling = &m_floorCeiling[x * 8];
+        floorCeiling[0] = sf::Vertex(sf::Vector2f(xPos, 0.0f), ceilingColor);
+        floorCeiling[1] = sf::Vertex(sf::Vector2f(xEnd, 0.0f), ceilingColor);
+        floorCeiling[2] = sf::Vertex(sf::Vector2f(xEnd, ceilingEnd), ceilingColor);
+        floorCeiling[3] = sf::Vertex(sf::Vector2f(xPos, ceilingEnd), ceilingColor);
+        floorCeiling[4] = sf::Vertex(sf::Vector2f(xPos, floorStart), floorColor);
+        floorCeiling[5] = sf::Vertex(sf::Vector2f(xEnd, floorStart), floorColor);
+        floorCeiling[6] = sf::Vertex(sf::Vector2f(xEnd, bottom), floorColor);
+        floorCeiling[7] = sf::Vertex(sf::Vector2f(xPos, bottom), floorColor);
+    }
+}
+
+// RGBA byte order in memory (little endian), which is what sf::Texture::update expects
+static inline sf::Uint32 packPixel(const sf::Color& color)
+{
+    return static_cast<sf::Uint32>(color.r)
+         | (static_cast<sf::Uint32>(color.g) << 8)
+         | (static_cast<sf::Uint32>(color.b) << 16)
+         | (static_cast<sf::Uint32>(color.a) << 24);
+}
+
+void Raycaster::rasterizeFramebuffer(float ambientComponent)
+{
+    // texture needs a GL context, so it is only created once this backend is actually used.
+    // it is sized for the full window, the current render width uses its left part
+    if (!m_frameTextureReady)
+    {
+        m_pixels.assign(static_cast<size_t>(m_outputWidth) * m_screenHeight, 0);
+        m_frameTexture.create(m_outputWidth, m_screenHeight);
+        m_frameSprite.setTexture(m_frameTexture, true);
+        m_frameTextureReady = true;
+    }
+    
+    const int stripeWidth = 64;
+    const int stripeCount = (m_renderWidth + stripeWidth - 1) / stripeWidth;
+    
+    // each thread owns a stripe of columns, so no two threads touch the same pixels
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int stripe = 0; stripe < stripeCount; ++stripe)
+    {
+        int firstColumn = stripe * stripeWidth;
+        int columns = std::min(stripeWidth, m_renderWidth - firstColumn);
+        
+        sf::Uint32 wallPixels[stripeWidth];
+        sf::Uint32 ceilingPixels[stripeWidth];
+        sf::Uint32 floorPixels[stripeWidth];
         
-        if (data.drawStart > 0)
+        for (int i = 0; i < columns; ++i)
         {
-            float lightSourceCeiling = std::max(0.0f, data.rawLighting - ambientComponent);
-            float foggedAmbientCeiling = ambientComponent * data.distanceFog;
-            float finalCeilingLight = lightSourceCeiling + foggedAmbientCeiling;
-            
-            int ceilingValue = static_cast<int>(finalCeilingLight * 20.0f);
+            sf::Color wallColor, ceilingColor, floorColor;
+            shadeColumn(firstColumn + i, ambientComponent, wallColor, ceilingColor, floorColor);
             
-            sf::Color ceilingColor(ceilingValue, ceilingValue, ceilingValue);
-            m_floorCeiling.append(sf::Vertex(sf::Vector2f(xPos, 0.0f), ceilingColor));
-            m_floorCeiling.append(sf::Vertex(sf::Vector2f(xPos + 1.0f, 0.0f), ceilingColor));
-            m_floorCeiling.append(sf::Vertex(sf::Vector2f(xPos + 1.0f, yStart), ceilingColor));
-            m_floorCeiling.append(sf::Vertex(sf::Vector2f(xPos, yStart), ceilingColor));
+            wallPixels[i] = packPixel(wallColor);
+            ceilingPixels[i] = packPixel(ceilingColor);
+            floorPixels[i] = packPixel(floorColor);
         }
         
-        if (data.drawEnd < m_screenHeight)
+        // walk rows outer so every write stays inside the stripe's slice of the row
+        for (int y = 0; y < m_screenHeight; ++y)
         {
-            float lightSourceFloor = std::max(0.0f, data.rawLighting - ambientComponent);
-            float foggedAmbientFloor = ambientComponent * data.distanceFog;
-            float finalFloorLight = lightSourceFloor + foggedAmbientFloor;
-            
-            int floorValue = static_cast<int>(finalFloorLight * 30.0f);
+            sf::Uint32* row = &m_pixels[static_cast<size_t>(y) * m_renderWidth + firstColumn];
             
-            sf::Color floorColor(floorValue, floorValue, floorValue);
-            m_floorCeiling.append(sf::Vertex(sf::Vector2f(xPos, yEnd), floorColor));
-            m_floorCeiling.append(sf::Vertex(sf::Vector2f(xPos + 1.0f, yEnd), floorColor));
-            m_floorCeiling.append(sf::Vertex(sf::Vector2f(xPos + 1.0f, static_cast<float>(m_screenHeight)), floorColor));
-            m_floorCeiling.append(sf::Vertex(sf::Vector2f(xPos, static_cast<float>(m_screenHeight)), floorColor));
+            for (int i = 0; i < columns; ++i)
+            {
+                const RayData& data = m_rayDataBuffer[firstColumn + i];
+                
+                if (y < data.drawStart)
+                    row[i] = ceilingPixels[i];
+                else if (y < data.drawEnd)
+                    row[i] = wallPixels[i];
+                else
+                    row[i] = floorPixels[i];
+            }
         }
     }
     
-    window.draw(m_floorCeiling);
-    window.draw(m_wallSlices);
+    // upload only the rendered columns and stretch them to the window
+    m_frameTexture.update(reinterpret_cast<const sf::Uint8*>(m_pixels.data()), m_renderWidth, m_screenHeight, 0, 0);
+    m_frameSprite.setTextureRect(sf::IntRect(0, 0, m_renderWidth, m_screenHeight));
+    m_frameSprite.setScale(static_cast<float>(m_outputWidth) / static_cast<float>(m_renderWidth), 1.0f);
 }
@@ -6,15 +6,30 @@ class Map;
 class Player;
 class LightSystem;
 enum class LightingQuality;
+enum class RenderBackend;
 
 class Raycaster
 {
 public:
     Raycaster(int screenWidth, int screenHeight);
     
-    void render(sf::RenderWindow& window, const Player& player, const Map& map, const LightSystem& lightSystem);
+    // lightSystem is non-const only to lend it this frame's depth buffer as the flashlight shadow map
+    void render(sf::RenderWindow& window, const Player& player, const Map& map, LightSystem& lightSystem);
     
-    void setLightingQuality(LightingQuality quality) { m_lightingQuality = quality; }
+    void setLightingQuality(LightingQuality quality);
+    void setRenderBackend(RenderBackend backend) { m_renderBackend = backend; }
+    
+    // dynamic resolution - internal column count follows the measured frame time
+    void setDynamicResolution(bool enabled);
+    void setTargetFPS(int targetFPS) { m_frameBudget = targetFPS > 0 ? 1.0f / static_cast<float>(targetFPS) : 0.0f; }
+    void updateResolutionScale(float frameTime);
+    int getRenderWidth() const { return m_renderWidth; }
+    
+    // trace only wall-face boundaries and fill the columns in between analytically
+    void setWallSpanTracing(bool enabled);
+    
+    // forget last frame's rays/lighting (call when the map or lights change under the same camera)
+    void invalidateHistory();
     
 private:
     struct RayHit
@@ -27,22 +42,179 @@ private:
         float hitY;
     };
     
-    RayHit castRay(float rayAngle, const Player& player, const Map& map);
+    static void finishRay(RayHit& hit, float posX, float posY, float rayDirX, float rayDirY,
+                          int mapX, int mapY, int stepX, int stepY, int side);
+    
+    RayHit castRay(float rayDirX, float rayDirY, const Player& player, const Map& map);
+    
+    // packet version - traces 8 adjacent columns together (AVX2), scalar fallback otherwise
+    void castRayPacket(const float* rayDirX, const float* rayDirY, const Player& player, const Map& map, RayHit* hits);
+    
+    // per-column camera-space directions, rebuilt only when width or FOV changes
+    void buildCameraTable();
+    
+    float smoothLighting(int x) const;
+    
+    // final wall/ceiling/floor colors of one column (shared by both backends)
+    void shadeColumn(int x, float ambientComponent, sf::Color& wallColor, sf::Color& ceilingColor, sf::Color& floorColor) const;
     
-    int m_screenWidth;
+    void traceColumns(const Player& player, const Map& map);
+    void traceColumnsFromCache(const Player& player, const Map& map);
+    void traceColumnSpans(const Player& player, const Map& map);
+    void storeColumn(int x, const RayHit& hit, float rayDirX, float rayDirY);
+    
+    static bool sameFace(const RayHit& a, const RayHit& b)
+    {
+        return a.mapX == b.mapX && a.mapY == b.mapY && a.hitVertical == b.hitVertical;
+    }
+    void lightColumns(const Player& player, const Map& map, LightSystem& lightSystem, float ambientComponent);
+    int lightSampleCount(float correctedDistance) const;  // volumetric samples per column, by quality
+    int lightingStride() const;                            // lighting LOD: every Nth column is lit, by quality
+    bool lightingContinuous(int x) const;                  // columns x - 1 and x hit one wall plane at a close depth
+    float sampleLighting(int channel, int entry) const;    // one m_sampleSlot entry's lighting, near-cache aware
+    void reprojectHistory(const Player& player);           // fills m_historyColumn for the current columns
+    
+    void emitVertices(float ambientComponent);
+    void rasterizeFramebuffer(float ambientComponent);
+    
+    void setRenderWidth(int width);
+    
+    int m_outputWidth;   // window width
+    int m_renderWidth;   // columns actually cast, stretched to m_outputWidth
     int m_screenHeight;
     float m_fov;
     
     sf::VertexArray m_floorCeiling;
     sf::VertexArray m_wallSlices;
     
+    // software framebuffer backend: RGBA pixels, uploaded once per frame
+    std::vector<sf::Uint32> m_pixels;
+    sf::Texture m_frameTexture;
+    sf::Sprite m_frameSprite;
+    bool m_frameTextureReady;
+    
     LightingQuality m_lightingQuality;
+    RenderBackend m_renderBackend;
+    
+    // resolution governor
+    bool m_dynamicResolution;
+    float m_frameBudget;
+    float m_resolutionScale;
+    std::vector<float> m_frameTimes;  // ring buffer of recent frame times
+    int m_frameTimeIndex;
+    int m_frameTimeCount;
+    int m_framesSinceResize;
+    
+    // what last frame's buffers were computed for
+    struct FrameKey
+    {
+        float x;
+        float y;
+        float angle;
+        bool flashlightOn;
+        int batteryBucket;
+        unsigned int mapRevision;    // Map::setTile
+        unsigned int lightRevision;  // runtime lights, flicker, finished bakes
+    };
+    FrameKey m_lastKey;
+    bool m_traceValid;     // m_rayDataBuffer geometry matches m_lastKey's pose
+    bool m_lightingValid;  // lighting matches m_lastKey's flashlight/battery
+    bool m_outputValid;    // vertices/pixels match the buffers
+    RenderBackend m_outputBackend;
+    
+    // 360 degree ray cache around the current position, so mouse look doesn't re-trace.
+    // bins are filled lazily and dropped (by bumping the generation) as soon as the player moves
+    static constexpr int ANGULAR_BINS = 8192;
+    std::vector<float> m_binDirX;
+    std::vector<float> m_binDirY;
+    std::vector<RayHit> m_angularHits;
+    std::vector<unsigned int> m_angularStamp;  // bin is valid when it matches m_angularGeneration
+    unsigned int m_angularGeneration;
+    std::vector<int> m_missingBins;
+    
+    // wall-span mode
+    static constexpr int SPAN_STRIDE = 8;
+    bool m_wallSpanTracing;
+    std::vector<int> m_spanAnchors;
+    std::vector<RayHit> m_columnHits;
+    
+    // camera table: cos/sin of each column's angle offset from the view direction.
+    // cos doubles as the fish-eye factor. padded to a multiple of 8 columns
+    std::vector<float> m_cameraCos;
+    std::vector<float> m_cameraSin;
+    std::vector<float> m_cameraAngle;
+    int m_cameraTableWidth;
+    float m_cameraTableFov;
     
     float m_lastLighting;
     
-    // smoothing buffer for lighting
+    // per-column wall lighting from pass 1, smoothed on the fly in pass 2
     std::vector<float> m_lightingBuffer;
-    std::vector<float> m_smoothedBuffer;
+    
+    // perpendicular wall distance per column, lent to the light system as the flashlight shadow map
+    std::vector<float> m_columnDepth;
+    
+    // the frame's lighting samples as SoA for LightSystem::calculateLightingBatch.
+    // m_sampleSlot[x * (MAX_LIGHT_SAMPLES + 1) + i] = index of column x's sample i (last = wall hit)
+    static constexpr int MAX_LIGHT_SAMPLES = 5;
+    std::vector<float> m_sampleX;
+    std::vector<float> m_sampleY;
+    std::vector<float> m_sampleLight[3];  // RGB, or gray in [0] only on LOW
+    std::vector<int> m_sampleSlot;
+    
+    // temporal lighting: last frame's per-column lighting (before tint and fog) and where it was
+    // measured. a column whose wall point was also seen last frame, at the depth we'd expect, lights
+    // only TEMPORAL_SAMPLES volumetric samples past the player (a rotating subset) and blends them
+    // into that history. the first frame at rest relights in full
+    static constexpr int TEMPORAL_SAMPLES = 1;
+    static constexpr float TEMPORAL_BLEND = 0.2f;            // weight of the fresh lighting
+    static constexpr float TEMPORAL_DEPTH_TOLERANCE = 0.05f;  // relative depth mismatch that rejects history
+    static constexpr float TEMPORAL_MAX_TURN = 0.25f;         // radians per frame, beyond that no history at all
+    static constexpr float TEMPORAL_MAX_MOVE = 0.5f;          // tiles per frame, same
+    bool m_temporalValid;
+    bool m_temporalPending;  // the last lighting used history - redo it in full once the camera rests
+    std::vector<float> m_historyLight[3];
+    std::vector<float> m_nextHistoryLight[3];
+    std::vector<float> m_historyDepth;
+    std::vector<unsigned char> m_historyVertical;
+    std::vector<int> m_historyColumn;   // current column -> last frame's column showing the same point, or -1
+    std::vector<int> m_columnSamples;   // volumetric samples of each lit column this frame
+    int m_historyWidth;
+    int m_historyChannels;
+    float m_historyX;
+    float m_historyY;
+    float m_historyDirX;
+    float m_historyDirY;
+    unsigned int m_temporalFrame;  // picks the sample subset, with the column index
+    
+    // near-player lighting cache: nodes NEAR_CACHE_RESOLUTION per tile on the world grid, within
+    // NEAR_CACHE_RADIUS tiles of the player. volumetric samples in there blend four nodes instead
+    // of being lit themselves - a node joins the frame's sample list the first time one needs it.
+    // such samples have m_sampleSlot = -1 - index into m_nearSamples
+    static constexpr int NEAR_CACHE_RESOLUTION = 4;
+    static constexpr int NEAR_CACHE_RADIUS = 4;
+    static constexpr int NEAR_CACHE_SIZE = 2 * NEAR_CACHE_RADIUS * NEAR_CACHE_RESOLUTION + 2;  // nodes per side
+    static constexpr float NEAR_CACHE_MIN_DISTANCE = 1.0f;  // the flashlight changes too fast right at its origin
+    struct NearSample
+    {
+        int node;  // top-left node, row-major in NEAR_CACHE_SIZE
+        float fx;
+        float fy;
+    };
+    std::vector<int> m_nearNodeSample;  // node -> index in the sample list, or one of the states below
+    static constexpr int NODE_UNCHECKED = -1;
+    static constexpr int NODE_HIDDEN = -2;  // not in clear view of the player, never blended
+    static constexpr int NODE_UNUSED = -3;  // usable, not needed by any sample yet
+    std::vector<NearSample> m_nearSamples;
+    int m_nearOriginX;  // world node coordinates of node 0
+    int m_nearOriginY;
+    
+    // lighting LOD: the columns lit this frame. the others lie on a continuous surface between
+    // two lit ones and interpolate them (m_litBefore = index in m_litColumns of the one at or left of x)
+    static constexpr float LOD_DEPTH_TOLERANCE = 0.1f;  // relative depth step that still counts as continuous
+    std::vector<int> m_litColumns;
+    std::vector<int> m_litBefore;
+    std::vector<float> m_columnLight[3];  // per-column lighting before tint and fog, same channels as m_sampleLight
     
     // cached ray data for two-pass rendering
     struct RayData
@@ -51,8 +223,17 @@ private:
         int drawStart;
         int drawEnd;
         bool hitVertical;
+        int mapX;  // wall tile that was hit
+        int mapY;
+        float rayDirX;
+        float rayDirY;
+        float hitX;
+        float hitY;
         float rawLighting;
         float distanceFog;
+        float tintR;  // light color relative to its brightest channel (all 1 when gray)
+        float tintG;
+        float tintB;
     };
     std::vector<RayData> m_rayDataBuffer;
 };
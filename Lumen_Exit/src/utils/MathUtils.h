@@ -1,5 +1,7 @@
 #pragma once
 #include <cmath>
+#include <cstddef>
+#include <new>
 #include <immintrin.h> // AVX/SSE intrinsics
 
 // Быстрые математические утилиты с SIMD оптимизациями
@@ -61,6 +63,26 @@ namespace MathUtils
 #endif
     }
     
+    // Арккосинус для 8 значений (AVX), x в [-1, 1]
+    // acos(x) ≈ sqrt(1 - |x|) * полином(|x|), ошибка ~7e-5 (Abramowitz & Stegun 4.4.45)
+#ifdef __AVX__
+    inline __m256 acos8_avx(__m256 x)
+    {
+        __m256 absX = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+        
+        __m256 poly = _mm256_set1_ps(-0.0187293f);
+        poly = _mm256_add_ps(_mm256_mul_ps(poly, absX), _mm256_set1_ps(0.0742610f));
+        poly = _mm256_add_ps(_mm256_mul_ps(poly, absX), _mm256_set1_ps(-0.2121144f));
+        poly = _mm256_add_ps(_mm256_mul_ps(poly, absX), _mm256_set1_ps(1.5707288f));
+        
+        __m256 result = _mm256_mul_ps(_mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), absX)), poly);
+        
+        // отрицательные x: acos(x) = PI - acos(-x)
+        __m256 negative = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ);
+        return _mm256_blendv_ps(result, _mm256_sub_ps(_mm256_set1_ps(PI), result), negative);
+    }
+#endif
+    
     // Быстрое вычисление sin и cos одновременно
     inline void sincos_fast(float angle, float& sinVal, float& cosVal)
     {
@@ -115,6 +137,14 @@ namespace MathUtils
         return value < min ? min : (value > max ? max : value);
     }
     
+    // Быстрый арккосинус (тот же полином, что и в acos8_avx)
+    inline float fast_acos(float x)
+    {
+        float absX = std::abs(x);
+        float result = std::sqrt(1.0f - absX) * (1.5707288f + absX * (-0.2121144f + absX * (0.0742610f + absX * -0.0187293f)));
+        return x < 0.0f ? PI - result : result;
+    }
+    
     // Нормализация угла в диапазон [-PI, PI]
     inline float normalize_angle(float angle)
     {
@@ -232,4 +262,39 @@ namespace MathUtils
         static TrigLookup lookup;
         return lookup;
     }
+    
+    // ============================================
+    // Выровненная память для SoA массивов
+    // ============================================
+    
+    // Аллокатор для std::vector с выравниванием под AVX (_mm256_load_ps)
+    template <typename T, size_t Alignment = 32>
+    struct AlignedAllocator
+    {
+        using value_type = T;
+        
+        template <typename U>
+        struct rebind { using other = AlignedAllocator<U, Alignment>; };
+        
+        AlignedAllocator() = default;
+        
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+        
+        T* allocate(size_t count)
+        {
+            void* memory = _mm_malloc(count * sizeof(T), Alignment);
+            if (memory == nullptr)
+                throw std::bad_alloc();
+            return static_cast<T*>(memory);
+        }
+        
+        void deallocate(T* memory, size_t) { _mm_free(memory); }
+        
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+        
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+    };
 }
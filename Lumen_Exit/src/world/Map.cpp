@@ -5,8 +5,10 @@
 
 Map::Map(int width, int height, unsigned int seed)
     : m_width(width), m_height(height)
+    , m_occupancyStride(0)
     , m_spawnX(1), m_spawnY(1)
     , m_seed(seed)
+    , m_revision(0)
 {
     // maze algo needs odd dimensions
     if (m_width % 2 == 0) m_width++;
@@ -21,6 +23,32 @@ Map::Map(int width, int height, unsigned int seed)
     
     std::cout << "Generating maze with seed: " << m_seed << std::endl;
     generateMaze(m_seed);
+    buildOccupancy();
+    buildDistanceField();
+    buildRegionGraph();
+}
+
+void Map::buildOccupancy()
+{
+    int paddedWidth = m_width + 2 * OCCUPANCY_PAD;
+    int paddedHeight = m_height + 2 * OCCUPANCY_PAD;
+    
+    m_occupancyStride = (paddedWidth + 31) / 32;
+    
+    // start all solid (border included), then clear the open tiles
+    m_occupancy.assign(static_cast<size_t>(m_occupancyStride) * paddedHeight, 0xFFFFFFFFu);
+    
+    for (int y = 0; y < m_height; ++y)
+    {
+        for (int x = 0; x < m_width; ++x)
+        {
+            if (m_tiles[y * m_width + x] != 1)
+            {
+                unsigned int bit = static_cast<unsigned int>(x + OCCUPANCY_PAD);
+                m_occupancy[(y + OCCUPANCY_PAD) * m_occupancyStride + (bit >> 5)] &= ~(1u << (bit & 31));
+            }
+        }
+    }
 }
 
 int Map::getTile(int x, int y) const
@@ -31,6 +59,200 @@ int Map::getTile(int x, int y) const
     return m_tiles[y * m_width + x];
 }
 
+void Map::buildDistanceField()
+{
+    // two-pass chessboard distance transform (exact for Chebyshev distance)
+    const int infinity = 255;
+    
+    m_wallDistance.assign(static_cast<size_t>(m_width) * m_height + 4, 0);
+    
+    // outside the map counts as wall
+    auto distanceAt = [&](int x, int y) -> int
+    {
+        if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+            return 0;
+        return m_wallDistance[y * m_width + x];
+    };
+    
+    for (int y = 0; y < m_height; ++y)
+    {
+        for (int x = 0; x < m_width; ++x)
+        {
+            if (m_tiles[y * m_width + x] == 1)
+                continue;
+            
+            int d = infinity;
+            d = std::min(d, distanceAt(x - 1, y) + 1);
+            d = std::min(d, distanceAt(x - 1, y - 1) + 1);
+            d = std::min(d, distanceAt(x, y - 1) + 1);
+            d = std::min(d, distanceAt(x + 1, y - 1) + 1);
+            m_wallDistance[y * m_width + x] = static_cast<uint8_t>(d);
+        }
+    }
+    
+    for (int y = m_height - 1; y >= 0; --y)
+    {
+        for (int x = m_width - 1; x >= 0; --x)
+        {
+            if (m_tiles[y * m_width + x] == 1)
+                continue;
+            
+            int d = m_wallDistance[y * m_width + x];
+            d = std::min(d, distanceAt(x + 1, y) + 1);
+            d = std::min(d, distanceAt(x + 1, y + 1) + 1);
+            d = std::min(d, distanceAt(x, y + 1) + 1);
+            d = std::min(d, distanceAt(x - 1, y + 1) + 1);
+            m_wallDistance[y * m_width + x] = static_cast<uint8_t>(d);
+        }
+    }
+}
+
+int Map::getRegion(int x, int y) const
+{
+    if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+        return -1;
+    
+    return m_regionId[y * m_width + x];
+}
+
+void Map::buildRegionGraph()
+{
+    m_regionId.assign(static_cast<size_t>(m_width) * m_height, -1);
+    m_regions.clear();
+    m_portals.clear();
+    
+    auto isFree = [&](int x, int y)
+    {
+        return x < m_width && y < m_height && m_tiles[y * m_width + x] != 1 && m_regionId[y * m_width + x] < 0;
+    };
+    
+    auto addRegion = [&](int x, int y, int width, int height, int room)
+    {
+        Region region;
+        region.x = x;
+        region.y = y;
+        region.width = width;
+        region.height = height;
+        region.room = room;
+        
+        // a room can lose tiles to setTile, those stay walls
+        for (int ty = y; ty < y + height; ++ty)
+            for (int tx = x; tx < x + width; ++tx)
+                if (m_tiles[ty * m_width + tx] != 1)
+                    m_regionId[ty * m_width + tx] = static_cast<int>(m_regions.size());
+        
+        m_regions.push_back(region);
+    };
+    
+    // rooms are carved whole, so each is one rectangle
+    for (int i = 0; i < static_cast<int>(m_rooms.size()); ++i)
+        addRegion(m_rooms[i].x, m_rooms[i].y, m_rooms[i].width, m_rooms[i].height, i);
+    
+    // corridors: a horizontal run where there is one, else a vertical run (junctions go to whichever comes first)
+    for (int y = 0; y < m_height; ++y)
+    {
+        for (int x = 0; x < m_width; ++x)
+        {
+            if (!isFree(x, y))
+                continue;
+            
+            int length = 1;
+            while (isFree(x + length, y))
+                length++;
+            
+            if (length > 1)
+            {
+                addRegion(x, y, length, 1, -1);
+                continue;
+            }
+            
+            while (isFree(x, y + length))
+                length++;
+            
+            addRegion(x, y, 1, length, -1);
+        }
+    }
+    
+    // portals: unit edges between two regions, merged while the same pair runs on along the same line
+    auto addPortal = [&](int a, int b, float x0, float y0, float x1, float y1)
+    {
+        Portal portal;
+        portal.regionA = a;
+        portal.regionB = b;
+        portal.x0 = x0;
+        portal.y0 = y0;
+        portal.x1 = x1;
+        portal.y1 = y1;
+        m_portals.push_back(portal);
+        return static_cast<int>(m_portals.size()) - 1;
+    };
+    
+    // vertical edges, between (x, y) and (x + 1, y)
+    for (int x = 0; x + 1 < m_width; ++x)
+    {
+        int open = -1;
+        for (int y = 0; y < m_height; ++y)
+        {
+            int a = m_regionId[y * m_width + x];
+            int b = m_regionId[y * m_width + x + 1];
+            
+            if (a < 0 || b < 0 || a == b)
+                open = -1;
+            else if (open >= 0 && m_portals[open].regionA == a && m_portals[open].regionB == b)
+                m_portals[open].y1 = static_cast<float>(y + 1);
+            else
+                open = addPortal(a, b, static_cast<float>(x + 1), static_cast<float>(y), static_cast<float>(x + 1), static_cast<float>(y + 1));
+        }
+    }
+    
+    // horizontal edges, between (x, y) and (x, y + 1)
+    for (int y = 0; y + 1 < m_height; ++y)
+    {
+        int open = -1;
+        for (int x = 0; x < m_width; ++x)
+        {
+            int a = m_regionId[y * m_width + x];
+            int b = m_regionId[(y + 1) * m_width + x];
+            
+            if (a < 0 || b < 0 || a == b)
+                open = -1;
+            else if (open >= 0 && m_portals[open].regionA == a && m_portals[open].regionB == b)
+                m_portals[open].x1 = static_cast<float>(x + 1);
+            else
+                open = addPortal(a, b, static_cast<float>(x), static_cast<float>(y + 1), static_cast<float>(x + 1), static_cast<float>(y + 1));
+        }
+    }
+    
+    for (int i = 0; i < static_cast<int>(m_portals.size()); ++i)
+    {
+        m_regions[m_portals[i].regionA].portals.push_back(i);
+        m_regions[m_portals[i].regionB].portals.push_back(i);
+    }
+}
+
+bool Map::setTile(int x, int y, int value)
+{
+    if (!isValidCell(x, y) || m_tiles[y * m_width + x] == value)
+        return false;
+    
+    m_tiles[y * m_width + x] = value;
+    
+    unsigned int bit = static_cast<unsigned int>(x + OCCUPANCY_PAD);
+    uint32_t& word = m_occupancy[(y + OCCUPANCY_PAD) * m_occupancyStride + (bit >> 5)];
+    
+    if (value == 1)
+        word |= 1u << (bit & 31);
+    else
+        word &= ~(1u << (bit & 31));
+    
+    // both are a few passes over the tiles - cheaper to redo than to patch
+    buildDistanceField();
+    buildRegionGraph();
+    
+    m_revision++;
+    return true;
+}
+
 bool Map::isWall(int x, int y) const
 {
     return getTile(x, y) == 1;
@@ -1,6 +1,9 @@
 #pragma once
 #include <vector>
 #include <random>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 
 struct Room
 {
@@ -11,6 +14,31 @@ struct Room
     int centerY() const { return y + height / 2; }
 };
 
+// cell-and-portal graph: the open tiles split into rectangles (each room, then straight corridor
+// runs), joined by portals - the edges two regions share
+struct Region
+{
+    int x, y;
+    int width, height;
+    int room = -1;               // index into Map::getRooms(), -1 for corridors
+    std::vector<int> portals;    // indices into Map::getPortals()
+};
+
+struct Portal
+{
+    int regionA, regionB;
+    float x0, y0, x1, y1;        // the shared edge, axis aligned, in tile units
+    
+    int other(int region) const { return region == regionA ? regionB : regionA; }
+    
+    float distanceTo(float px, float py) const
+    {
+        float dx = px - std::clamp(px, x0, x1);
+        float dy = py - std::clamp(py, y0, y1);
+        return std::sqrt(dx * dx + dy * dy);
+    }
+};
+
 class Map
 {
 public:
@@ -20,12 +48,43 @@ public:
     int getHeight() const { return m_height; }
     int getTile(int x, int y) const;
     bool isWall(int x, int y) const;
+    
+    // doors and collapsing corridors (1 = wall, 0 = open). keeps the occupancy, distance field and
+    // region graph in sync and bumps the revision; the border stays solid. false if nothing changed.
+    // tell the light system too (LightSystem::invalidateTile)
+    bool setTile(int x, int y, int value);
+    unsigned int getRevision() const { return m_revision; }
+    
+    // packed occupancy: 1 bit per tile, surrounded by a solid border OCCUPANCY_PAD tiles wide,
+    // so anything in [-PAD, size + PAD) can be read without bounds checks
+    static constexpr int OCCUPANCY_PAD = 2;
+    
+    bool isSolidFast(int x, int y) const
+    {
+        unsigned int bit = static_cast<unsigned int>(x + OCCUPANCY_PAD);
+        return (m_occupancy[(y + OCCUPANCY_PAD) * m_occupancyStride + (bit >> 5)] >> (bit & 31)) & 1u;
+    }
+    
+    // raw words for the SIMD raycaster - row r of the padded grid starts at r * stride
+    const uint32_t* getOccupancyData() const { return m_occupancy.data(); }
+    int getOccupancyStride() const { return m_occupancyStride; }
+    
+    // Chebyshev distance to the nearest wall (0 = wall, capped at 255). every tile with
+    // max(|dx|, |dy|) < d around (x, y) is open, so rays can jump across that box.
+    // no bounds checks - only valid inside the map
+    int getWallDistance(int x, int y) const { return m_wallDistance[y * m_width + x]; }
+    const uint8_t* getWallDistanceData() const { return m_wallDistance.data(); }
     bool isInRoom(int x, int y) const;
     bool isInExitRoom(int x, int y) const;
     
     void getSpawnPosition(float& outX, float& outY) const;
     const std::vector<Room>& getRooms() const { return m_rooms; }
     
+    // region graph, built with the maze. getRegion is -1 for walls and outside the map
+    int getRegion(int x, int y) const;
+    const std::vector<Region>& getRegions() const { return m_regions; }
+    const std::vector<Portal>& getPortals() const { return m_portals; }
+    
     unsigned int getSeed() const { return m_seed; }
     
 private:
@@ -33,13 +92,26 @@ private:
     void recursiveBacktracker(int x, int y, std::mt19937& rng);
     void addRooms(std::mt19937& rng, int roomCount);
     bool isValidCell(int x, int y) const;
+    void buildOccupancy();
+    void buildDistanceField();
+    void buildRegionGraph();
     
     int m_width;
     int m_height;
     std::vector<int> m_tiles;
     
+    std::vector<uint32_t> m_occupancy;
+    int m_occupancyStride;  // 32-bit words per padded row
+    
+    std::vector<uint8_t> m_wallDistance;  // +4 bytes tail so SIMD can gather 32-bit words
+    
     std::vector<Room> m_rooms;
+    
+    std::vector<int> m_regionId;  // per tile, -1 for walls
+    std::vector<Region> m_regions;
+    std::vector<Portal> m_portals;
     int m_spawnX;
     int m_spawnY;
     unsigned int m_seed;
+    unsigned int m_revision;
 };